@@ -0,0 +1,389 @@
+﻿#pragma once
+#include "common.h"
+#include "ringbuff.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+const DWORD BRIDGE_FRAME_MAGIC = 0x4742524D; // "MRBG"
+const DWORD DEFAULT_BRIDGE_BATCH = 64;
+const DWORD DEFAULT_BRIDGE_CREDITS = 1024;
+const DWORD BRIDGE_CREDIT_WAIT = 100;
+const DWORD BRIDGE_WRITE_RETRY_MAX = 100;     // самое долгое ожидание места за одну попытку записи
+const DWORD BRIDGE_DELIVERY_TIMEOUT = 30000;  // кольцо стоит дольше - вход считает потребителя пропавшим
+const DWORD BRIDGE_RECONNECT_INTERVAL = 1000;
+
+// Кадр моста: заголовок, затем recordCount пар "заголовок записи + данные"
+struct BridgeFrameHeader {
+    DWORD magic;
+    DWORD recordCount;
+    DWORD payloadBytes;
+};
+
+// Тики GetTickCount64 на двух машинах не связаны, поэтому для отложенной
+// записи передается оставшаяся задержка, а не абсолютный deliverAt
+struct BridgeRecordHeader {
+    DWORD length;
+    DWORD topic;
+    DWORD flags;    // RECORD_DELAYED или 0
+    DWORD delayMs;
+};
+
+// Обратный поток: приемник выдает кредиты - сколько еще записей он готов принять
+struct BridgeCreditGrant {
+    DWORD credits;
+};
+
+struct BridgeStats {
+    ULONG64 records;
+    ULONG64 batches;
+    ULONG64 creditWaits;
+};
+
+class WinsockSession {
+public:
+    WinsockSession() {
+        WSADATA data;
+        if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+            throw runtime_error("Cannot initialize Winsock");
+        }
+    }
+
+    ~WinsockSession() {
+        WSACleanup();
+    }
+
+    WinsockSession(const WinsockSession&) = delete;
+    WinsockSession& operator=(const WinsockSession&) = delete;
+};
+
+// Пачки маленькие и частые: алгоритм Нейгла только добавил бы задержку
+inline void ConfigureBridgeSocket(SOCKET socket) {
+    BOOL noDelay = TRUE;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+}
+
+// port == 0 - выбрать свободный порт (узнать его можно через GetBridgePort)
+inline SOCKET ListenBridge(const string& host, USHORT port) {
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET) {
+        throw runtime_error("Cannot create socket");
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1
+        || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR
+        || listen(listener, 1) == SOCKET_ERROR) {
+        closesocket(listener);
+        throw runtime_error("Cannot listen on " + host + ":" + to_string(port));
+    }
+
+    return listener;
+}
+
+inline USHORT GetBridgePort(SOCKET socket) {
+    sockaddr_in address = {};
+    int length = sizeof(address);
+    if (getsockname(socket, reinterpret_cast<sockaddr*>(&address), &length) == SOCKET_ERROR) {
+        return 0;
+    }
+    return ntohs(address.sin_port);
+}
+
+inline SOCKET AcceptBridge(SOCKET listener) {
+    SOCKET connection = accept(listener, NULL, NULL);
+    if (connection == INVALID_SOCKET) {
+        throw runtime_error("Cannot accept bridge connection");
+    }
+    ConfigureBridgeSocket(connection);
+    return connection;
+}
+
+inline SOCKET ConnectBridge(const string& host, USHORT port) {
+    SOCKET connection = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (connection == INVALID_SOCKET) {
+        throw runtime_error("Cannot create socket");
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1
+        || connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR) {
+        closesocket(connection);
+        throw runtime_error("Cannot connect to " + host + ":" + to_string(port));
+    }
+
+    ConfigureBridgeSocket(connection);
+    return connection;
+}
+
+inline bool SendAll(SOCKET socket, const char* data, int length) {
+    while (length > 0) {
+        int sent = send(socket, data, length, 0);
+        if (sent == SOCKET_ERROR || sent == 0) return false;
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+inline bool ReceiveAll(SOCKET socket, char* data, int length) {
+    while (length > 0) {
+        int received = recv(socket, data, length, 0);
+        if (received == SOCKET_ERROR || received == 0) return false;
+        data += received;
+        length -= received;
+    }
+    return true;
+}
+
+// Выход моста: вычитывает локальное кольцо пачками и отправляет их в сокет.
+// Пачка уходит одним WSASend по массиву WSABUF: заголовок, длины и сами записи
+// не склеиваются в промежуточный буфер. Пачка не больше выданных кредитов.
+// Вычитанная из кольца пачка хранится, пока не уйдет целиком: при обрыве она
+// отправляется заново по новому соединению (см. Reconnect). Если обрыв случился
+// после того, как кадр дошел, вход получит его дважды - доставка "хотя бы раз".
+class BridgeOutbound {
+private:
+    RingBuffer& ring;
+    SOCKET connection;
+    DWORD batchSize;
+    DWORD credits;
+    DWORD pending;      // записей в неотправленной пачке
+    BridgeStats stats;
+
+    BridgeFrameHeader frame;
+    vector<string> records;
+    vector<ULONGLONG> deliverTimes;
+    vector<BridgeRecordHeader> recordHeaders;
+    vector<WSABUF> buffers;
+
+    // wait == false - только забрать уже пришедшие кредиты
+    bool ReceiveCredits(bool wait) {
+        while (true) {
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(connection, &readable);
+            timeval timeout = { 0, wait ? static_cast<long>(BRIDGE_CREDIT_WAIT * 1000) : 0 };
+
+            int ready = select(static_cast<int>(connection + 1), &readable, NULL, NULL, &timeout);
+            if (ready == SOCKET_ERROR) return false;
+            if (ready == 0) return true;
+
+            BridgeCreditGrant grant;
+            if (!ReceiveAll(connection, reinterpret_cast<char*>(&grant), sizeof(grant))) return false;
+            credits += grant.credits;
+            wait = false;
+        }
+    }
+
+public:
+    // Кадр собирается заново при каждой попытке: буферы указывают на строки records,
+    // а оставшаяся задержка отсчитывается от момента отправки
+    bool SendPending() {
+        DWORD payloadBytes = 0;
+        ULONGLONG now = GetTickCount64();
+        buffers[0].buf = reinterpret_cast<char*>(&frame);
+        buffers[0].len = sizeof(frame);
+        for (DWORD i = 0; i < pending; i++) {
+            ULONGLONG deliverAt = deliverTimes[i];
+            recordHeaders[i].delayMs = deliverAt > now ? static_cast<DWORD>(min<ULONGLONG>(deliverAt - now, MAXDWORD)) : 0;
+            buffers[1 + 2 * i].buf = reinterpret_cast<char*>(&recordHeaders[i]);
+            buffers[1 + 2 * i].len = sizeof(BridgeRecordHeader);
+            buffers[2 + 2 * i].buf = &records[i][0];
+            buffers[2 + 2 * i].len = recordHeaders[i].length;
+            payloadBytes += sizeof(BridgeRecordHeader) + recordHeaders[i].length;
+        }
+        frame = { BRIDGE_FRAME_MAGIC, pending, payloadBytes };
+
+        // Блокирующий сокет: WSASend возвращается, отправив все буферы
+        DWORD sent = 0;
+        if (WSASend(connection, buffers.data(), 1 + 2 * pending, &sent, 0, NULL, NULL) == SOCKET_ERROR
+            || sent != sizeof(frame) + payloadBytes) {
+            return false;
+        }
+
+        // Пачка, вычитанная под кредиты прошлого соединения, может превысить окно нового
+        credits -= min(credits, pending);
+        stats.records += pending;
+        stats.batches++;
+        pending = 0;
+        return true;
+    }
+
+public:
+    BridgeOutbound(RingBuffer& source, SOCKET bridgeSocket, DWORD maxBatch = DEFAULT_BRIDGE_BATCH)
+        : ring(source), connection(bridgeSocket), batchSize(max<DWORD>(maxBatch, 1)), credits(0), pending(0),
+        stats() {
+        records.resize(batchSize);
+        deliverTimes.resize(batchSize);
+        recordHeaders.resize(batchSize);
+        buffers.resize(1 + 2 * static_cast<size_t>(batchSize));
+    }
+
+    // Пересылает одну пачку: сначала неотправленную, иначе из того, что уже есть в кольце.
+    // forwarded - сколько записей вычитано из кольца (их кредиты вернулись Sender'ам);
+    // false - соединение потеряно, вычитанное остается в пачке до Reconnect
+    bool Pump(DWORD& forwarded) {
+        forwarded = 0;
+
+        if (!ReceiveCredits(false)) return false;
+        if (credits == 0) {
+            stats.creditWaits++;
+            return ReceiveCredits(true);
+        }
+        if (pending > 0) return SendPending();
+
+        DWORD limit = min(batchSize, credits);
+        RecordInfo info;
+        while (pending < limit && ring.ReadMessage(records[pending], info)) {
+            deliverTimes[pending] = info.deliverAt;
+            recordHeaders[pending] = { static_cast<DWORD>(records[pending].size()), info.topic,
+                info.deliverAt ? RECORD_DELAYED : 0u, 0 };
+            pending++;
+        }
+        forwarded = pending;
+        if (pending == 0) return true;
+
+        return SendPending();
+    }
+
+    // Новое соединение после обрыва; кредиты выдает вход этого соединения
+    void Reconnect(SOCKET bridgeSocket) {
+        connection = bridgeSocket;
+        credits = 0;
+    }
+
+    DWORD GetCredits() const {
+        return credits;
+    }
+
+    DWORD GetPendingCount() const {
+        return pending;
+    }
+
+    const BridgeStats& GetStats() const {
+        return stats;
+    }
+};
+
+// Вход моста: принимает кадры и пишет записи в удаленное кольцо. Кредиты
+// возвращаются только после записи в кольцо, поэтому медленный потребитель
+// на этой стороне останавливает выход моста, а не переполняет сокет.
+// В кольцо с кредитами вход пишет только как отдельный Sender со своей долей
+// (AttachCredits у переданного кольца): иначе он занимал бы слоты, обещанные Sender'ам.
+class BridgeInbound {
+private:
+    RingBuffer& ring;
+    SOCKET connection;
+    DWORD creditWindow;
+    DWORD ungranted;
+    DWORD deliveryTimeout;
+    volatile LONG stopping;
+    BridgeStats stats;
+    vector<char> payload;
+
+    bool GrantCredits(DWORD credits) {
+        BridgeCreditGrant grant = { credits };
+        return SendAll(connection, reinterpret_cast<const char*>(&grant), sizeof(grant));
+    }
+
+    // Оставшаяся задержка отсчитывается от момента приема, время в пути к ней прибавляется
+    bool WriteRecord(const BridgeRecordHeader& recordHeader, const string& record, DWORD timeoutMs) {
+        if (recordHeader.flags & RECORD_DELAYED) {
+            return ring.WriteDelayedMessage(record, recordHeader.delayMs, timeoutMs, recordHeader.topic);
+        }
+        return ring.WriteMessageTo(recordHeader.topic, record, timeoutMs);
+    }
+
+    // Ждет места в кольце попытками со все более долгим ожиданием, между ними проверяя
+    // Stop. false - вход остановлен или кольцо не освободилось за deliveryTimeout
+    bool DeliverRecord(const BridgeRecordHeader& recordHeader, const string& record) {
+        ULONGLONG deadline = GetTickCount64() + deliveryTimeout;
+        DWORD waitMs = 1;
+
+        while (!WriteRecord(recordHeader, record, waitMs)) {
+            // В режимах overwrite/drop кольцо само решает судьбу записи
+            if (ring.GetOverflowPolicy() != OVERFLOW_BLOCK) return true;
+            if (ReadAcquire(&stopping)) return false;
+
+            ULONGLONG now = GetTickCount64();
+            if (now >= deadline) return false;
+            waitMs = static_cast<DWORD>(min<ULONGLONG>({ waitMs * 2ull, BRIDGE_WRITE_RETRY_MAX, deadline - now }));
+        }
+        return true;
+    }
+
+public:
+    BridgeInbound(RingBuffer& target, SOCKET bridgeSocket, DWORD credits = DEFAULT_BRIDGE_CREDITS,
+        DWORD timeoutMs = BRIDGE_DELIVERY_TIMEOUT)
+        : ring(target), connection(bridgeSocket), creditWindow(max<DWORD>(credits, 1)), ungranted(0),
+        deliveryTimeout(timeoutMs), stopping(0), stats() {
+        if (ring.GetCreditSenders() > 0 && ring.GetCreditSource() == NO_CREDIT_SOURCE) {
+            throw runtime_error("Bridge into a credited ring needs its own credit entry");
+        }
+        if (!GrantCredits(creditWindow)) {
+            throw runtime_error("Cannot send initial bridge credits");
+        }
+    }
+
+    // Принимает один кадр (ждет его); false - соединение закрыто, поток поврежден,
+    // вход остановлен или кольцо стоит дольше deliveryTimeout. Недоставленный остаток
+    // кадра теряется: выход моста считает его отправленным
+    bool Pump(DWORD& delivered) {
+        delivered = 0;
+
+        BridgeFrameHeader frame;
+        if (!ReceiveAll(connection, reinterpret_cast<char*>(&frame), sizeof(frame))
+            || frame.magic != BRIDGE_FRAME_MAGIC) {
+            return false;
+        }
+
+        payload.resize(frame.payloadBytes);
+        if (frame.payloadBytes > 0 && !ReceiveAll(connection, payload.data(), static_cast<int>(frame.payloadBytes))) {
+            return false;
+        }
+
+        string record;
+        size_t offset = 0;
+        for (DWORD i = 0; i < frame.recordCount; i++) {
+            BridgeRecordHeader recordHeader;
+            if (offset + sizeof(recordHeader) > payload.size()) return false;
+            memcpy(&recordHeader, &payload[offset], sizeof(recordHeader));
+            offset += sizeof(recordHeader);
+            if (offset + recordHeader.length > payload.size()) return false;
+
+            record.assign(&payload[offset], recordHeader.length);
+            offset += recordHeader.length;
+
+            if (!DeliverRecord(recordHeader, record)) {
+                stats.records += delivered;
+                return false;
+            }
+            delivered++;
+        }
+
+        stats.records += delivered;
+        stats.batches++;
+
+        // Кредиты возвращаются порциями, а не на каждую пачку
+        ungranted += delivered;
+        if (ungranted >= max<DWORD>(creditWindow / 4, 1)) {
+            if (!GrantCredits(ungranted)) return false;
+            ungranted = 0;
+        }
+        return true;
+    }
+
+    // Из другого потока: Pump, ждущий места в кольце, вернет false. Ожидание кадра в
+    // сокете Stop не прерывает - для этого соединение закрывают (shutdown)
+    void Stop() {
+        InterlockedExchange(&stopping, 1);
+    }
+
+    const BridgeStats& GetStats() const {
+        return stats;
+    }
+};
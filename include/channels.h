@@ -0,0 +1,279 @@
+﻿#pragma once
+#include "common.h"
+#include "ringbuff.h"
+
+const DWORD CHANNEL_SEGMENT_MAGIC = 0x4C42524D; // "MRBL"
+const DWORD MAX_CHANNEL_NAME = 48;
+const DWORD DEFAULT_CHANNEL_DIRECTORY = 1024;
+const DWORD DEFAULT_SEGMENT_SIZE = 16 * 1024 * 1024;
+
+enum ChannelState : LONG {
+    CHANNEL_EMPTY = 0,
+    CHANNEL_INITIALIZING = 1,
+    CHANNEL_READY = 2,
+    CHANNEL_ABANDONED = 3   // место под кольцо не нашлось; слот каталога пропускается при поиске
+};
+
+// Запись каталога: имя канала -> смещение его кольца внутри сегмента
+struct ChannelEntry {
+    volatile LONG state;
+    DWORD hash;
+    char name[MAX_CHANNEL_NAME];
+    LONG64 offset;
+};
+
+struct SegmentHeader {
+    DWORD magic;
+    DWORD directorySize;
+    DWORD numaNode;
+    LONG64 segmentSize;
+    alignas(CACHE_LINE_SIZE) volatile LONG64 allocOffset;
+    volatile LONG channelCount;
+};
+
+// Один файл и одно отображение на все каналы узла. Каталог - хэш-таблица
+// с открытой адресацией; кольца выделяются из сегмента и никогда не освобождаются.
+class ChannelSegment {
+private:
+    HANDLE hFile;
+    HANDLE hFileMapping;
+    SegmentHeader* pHeader;
+    ChannelEntry* pDirectory;
+    string fileName;
+
+    static DWORD HashName(const string& name);
+    ChannelEntry* FindEntry(const string& name, bool create, bool& created);
+    static unique_ptr<RingBuffer> CheckExisting(unique_ptr<RingBuffer> ring, const string& name, DWORD recordCount,
+        DWORD recordSize, OverflowPolicy policy, DWORD creditSenders);
+
+public:
+    // segmentSize == 0 - подключиться к существующему сегменту
+    ChannelSegment(const string& name, DWORD segmentSize = DEFAULT_SEGMENT_SIZE,
+        DWORD directorySize = DEFAULT_CHANNEL_DIRECTORY, DWORD numaNode = NUMA_NO_PREFERRED_NODE);
+    ~ChannelSegment();
+
+    // Существующий канал возвращается как есть (с его сообщениями), если параметры
+    // совпадают; иначе - исключение. Владелец может сбросить его через RingBuffer::Reset.
+    unique_ptr<RingBuffer> CreateChannel(const string& name, DWORD recordCount,
+        DWORD recordSize = MAX_MESSAGE_SIZE, OverflowPolicy policy = OVERFLOW_BLOCK, DWORD creditSenders = 0);
+    unique_ptr<RingBuffer> OpenChannel(const string& name);
+    DWORD GetChannelCount() const;
+    LONG64 GetFreeSpace() const;
+};
+
+// Адрес канала имеет вид "<файл сегмента>@<имя канала>"
+inline bool SplitChannelAddress(const string& address, string& segmentName, string& channelName) {
+    size_t separator = address.rfind('@');
+    if (separator == string::npos || separator == 0 || separator + 1 == address.size()) {
+        return false;
+    }
+
+    segmentName = address.substr(0, separator);
+    channelName = address.substr(separator + 1);
+    return true;
+}
+
+inline ChannelSegment::ChannelSegment(const string& name, DWORD segmentSize, DWORD directorySize, DWORD numaNode)
+    : hFile(INVALID_HANDLE_VALUE), hFileMapping(NULL), pHeader(nullptr),
+    pDirectory(nullptr), fileName(name) {
+
+    // Первый создатель размечает сегмент, остальные подключаются к готовому
+    HANDLE hInitMutex = CreateMutexA(NULL, FALSE, (name + "_SegmentInit").c_str());
+    if (!hInitMutex) {
+        throw runtime_error("Cannot create segment init mutex");
+    }
+    WaitForSingleObject(hInitMutex, INFINITE);
+
+    hFile = CreateFileA(name.c_str(),
+        GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL,
+        segmentSize > 0 ? OPEN_ALWAYS : OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE) {
+        ReleaseMutex(hInitMutex);
+        CloseHandle(hInitMutex);
+        throw runtime_error("Cannot open segment file: " + name);
+    }
+
+    bool initialize = segmentSize > 0 && GetFileSize(hFile, NULL) == 0;
+    if (initialize) {
+        SetFilePointer(hFile, segmentSize, NULL, FILE_BEGIN);
+        SetEndOfFile(hFile);
+    }
+
+    hFileMapping = CreateFileMappingNumaA(hFile, NULL, PAGE_READWRITE, 0, 0, NULL, numaNode);
+    if (hFileMapping) {
+        pHeader = static_cast<SegmentHeader*>(MapViewOfFileExNuma(hFileMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0,
+            NULL, numaNode));
+    }
+
+    if (!pHeader) {
+        if (hFileMapping) CloseHandle(hFileMapping);
+        CloseHandle(hFile);
+        ReleaseMutex(hInitMutex);
+        CloseHandle(hInitMutex);
+        throw runtime_error("Cannot map segment: " + name);
+    }
+
+    pDirectory = reinterpret_cast<ChannelEntry*>(pHeader + 1);
+
+    if (initialize) {
+        LONG64 directoryEnd = sizeof(SegmentHeader) + static_cast<LONG64>(directorySize) * sizeof(ChannelEntry);
+
+        pHeader->directorySize = directorySize;
+        pHeader->numaNode = numaNode;
+        pHeader->segmentSize = segmentSize;
+        pHeader->allocOffset = (directoryEnd + CACHE_LINE_SIZE - 1) & ~static_cast<LONG64>(CACHE_LINE_SIZE - 1);
+        pHeader->channelCount = 0;
+        memset(pDirectory, 0, static_cast<size_t>(directorySize) * sizeof(ChannelEntry));
+        pHeader->magic = CHANNEL_SEGMENT_MAGIC;
+    }
+
+    ReleaseMutex(hInitMutex);
+    CloseHandle(hInitMutex);
+
+    if (pHeader->magic != CHANNEL_SEGMENT_MAGIC) {
+        UnmapViewOfFile(pHeader);
+        CloseHandle(hFileMapping);
+        CloseHandle(hFile);
+        throw runtime_error("Not a channel segment: " + name);
+    }
+}
+
+inline ChannelSegment::~ChannelSegment() {
+    if (pHeader) UnmapViewOfFile(pHeader);
+    if (hFileMapping) CloseHandle(hFileMapping);
+    if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+}
+
+// FNV-1a
+inline DWORD ChannelSegment::HashName(const string& name) {
+    DWORD hash = 2166136261u;
+    for (unsigned char c : name) {
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+// Линейное пробирование. Пустой слот занимается CAS'ом, и до публикации (READY)
+// остальные участники ждут его, чтобы один и тот же канал не был создан дважды.
+inline ChannelEntry* ChannelSegment::FindEntry(const string& name, bool create, bool& created) {
+    created = false;
+    if (name.empty() || name.size() >= MAX_CHANNEL_NAME) {
+        throw runtime_error("Invalid channel name: " + name);
+    }
+
+    DWORD hash = HashName(name);
+    DWORD directorySize = pHeader->directorySize;
+
+    for (DWORD probe = 0; probe < directorySize; probe++) {
+        ChannelEntry* entry = &pDirectory[(hash + probe) % directorySize];
+        LONG state = ReadAcquire(&entry->state);
+
+        if (state == CHANNEL_EMPTY) {
+            if (!create) return nullptr;
+
+            if (InterlockedCompareExchange(&entry->state, CHANNEL_INITIALIZING, CHANNEL_EMPTY) == CHANNEL_EMPTY) {
+                entry->hash = hash;
+                strcpy_s(entry->name, MAX_CHANNEL_NAME, name.c_str());
+                created = true;
+                return entry;
+            }
+            state = ReadAcquire(&entry->state);
+        }
+
+        while (state == CHANNEL_INITIALIZING) {
+            SwitchToThread();
+            state = ReadAcquire(&entry->state);
+        }
+
+        if (state == CHANNEL_READY && entry->hash == hash && name == entry->name) {
+            return entry;
+        }
+    }
+
+    if (create) {
+        throw runtime_error("Channel directory is full");
+    }
+    return nullptr;
+}
+
+inline unique_ptr<RingBuffer> ChannelSegment::CreateChannel(const string& name, DWORD recordCount,
+    DWORD recordSize, OverflowPolicy policy, DWORD creditSenders) {
+
+    if (recordCount == 0) {
+        throw runtime_error("Channel must have at least one record");
+    }
+    if (creditSenders > recordCount) {
+        throw runtime_error("Queue is too small to give every sender a credit");
+    }
+
+    auto existing = OpenChannel(name);
+    if (existing) return CheckExisting(move(existing), name, recordCount, recordSize, policy, creditSenders);
+
+    // Сначала слот каталога, потом место: проигравший гонку создатель ничего не выделяет,
+    // а сегмент переживает запуски, и потерянное место не вернулось бы никогда
+    bool created;
+    ChannelEntry* entry = FindEntry(name, true, created);
+
+    if (!created) {
+        return CheckExisting(make_unique<RingBuffer>(reinterpret_cast<char*>(pHeader) + entry->offset, 0),
+            name, recordCount, recordSize, policy, creditSenders);
+    }
+
+    LONG64 size = (RingBuffer::GetRequiredSize(recordCount, recordSize, creditSenders) + CACHE_LINE_SIZE - 1)
+        & ~static_cast<LONG64>(CACHE_LINE_SIZE - 1);
+    LONG64 offset = ReadAcquire64(&pHeader->allocOffset);
+
+    while (true) {
+        if (offset + size > pHeader->segmentSize) {
+            // Вернуть слот в EMPTY нельзя - это сломало бы цепочку пробирования
+            WriteRelease(&entry->state, CHANNEL_ABANDONED);
+            throw runtime_error("Channel segment is full");
+        }
+
+        LONG64 observed = InterlockedCompareExchange64(&pHeader->allocOffset, offset + size, offset);
+        if (observed == offset) break;
+        offset = observed;
+    }
+
+    auto ring = make_unique<RingBuffer>(reinterpret_cast<char*>(pHeader) + offset, recordCount, recordSize,
+        policy, pHeader->numaNode, creditSenders);
+
+    entry->offset = offset;
+    InterlockedIncrement(&pHeader->channelCount);
+    WriteRelease(&entry->state, CHANNEL_READY);
+
+    return ring;
+}
+
+// Под другим размером или политикой тот же канал не отдаем: создатель рассчитывает
+// на свои параметры, а кольцо под старые может быть меньше и без таблицы кредитов
+inline unique_ptr<RingBuffer> ChannelSegment::CheckExisting(unique_ptr<RingBuffer> ring, const string& name,
+    DWORD recordCount, DWORD recordSize, OverflowPolicy policy, DWORD creditSenders) {
+    if (ring->GetCapacity() != recordCount || ring->GetRecordSize() != recordSize
+        || ring->GetOverflowPolicy() != policy || ring->GetCreditSenders() != creditSenders) {
+        throw runtime_error("Channel " + name + " already exists with different parameters");
+    }
+    return ring;
+}
+
+inline unique_ptr<RingBuffer> ChannelSegment::OpenChannel(const string& name) {
+    bool created;
+    ChannelEntry* entry = FindEntry(name, false, created);
+    if (!entry) return nullptr;
+
+    return make_unique<RingBuffer>(reinterpret_cast<char*>(pHeader) + entry->offset, 0);
+}
+
+inline DWORD ChannelSegment::GetChannelCount() const {
+    return static_cast<DWORD>(pHeader->channelCount);
+}
+
+inline LONG64 ChannelSegment::GetFreeSpace() const {
+    LONG64 freeSpace = pHeader->segmentSize - ReadAcquire64(&pHeader->allocOffset);
+    return freeSpace > 0 ? freeSpace : 0;
+}
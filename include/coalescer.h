@@ -0,0 +1,175 @@
+﻿#pragma once
+#include "common.h"
+#include "ringbuff.h"
+
+const DWORD DEFAULT_COALESCE_DELAY_US = 50;
+
+// Склейка мелких сообщений в духе Nagle: сообщения одной темы копятся в локальном
+// буфере и публикуются одной записью RECORD_BATCH, когда следующее не помещается
+// в запись кольца или истек срок flushDelayUs с первого буферизованного сообщения.
+// Одна запись вместо многих - один CAS и один сигнал на всю пачку.
+// Срок проверяется в Write и Poll; если сообщений долго нет, Poll должен позвать
+// владелец - по таймеру из GetFlushTimer, иначе пачка ждет следующей записи.
+class MessageCoalescer {
+private:
+    RingBuffer& ring;
+    HANDLE hSignal;
+    HANDLE hFlushTimer;
+    DWORD flushDelayUs;
+    LONGLONG flushDelayTicks;
+    LONGLONG flushDeadline;
+    string batch;
+    DWORD batchTopic;
+    DWORD batchMessages;
+    LONG64 publishedRecords;
+    LONG64 publishedMessages;
+
+    static LONGLONG Now();
+    void ArmFlushTimer();
+    bool Publish(DWORD topic, const string& record, DWORD messages, bool packed, DWORD timeoutMs);
+
+public:
+    // hSignal - событие, которое взводится после каждой опубликованной записи (NULL - не нужно)
+    MessageCoalescer(RingBuffer& ringBuffer, DWORD flushDelayUs = DEFAULT_COALESCE_DELAY_US, HANDLE signal = NULL);
+    ~MessageCoalescer();
+
+    MessageCoalescer(const MessageCoalescer&) = delete;
+    MessageCoalescer& operator=(const MessageCoalescer&) = delete;
+
+    // false - буфер не удалось освободить за timeoutMs, сообщение не принято
+    bool Write(DWORD topic, const string& message, DWORD timeoutMs = 0);
+    // Публикует буфер, если истек срок; вызывать, когда новых сообщений нет
+    bool Poll(DWORD timeoutMs = 0);
+    bool Flush(DWORD timeoutMs = 0);
+    // Таймер с автосбросом срабатывает к сроку сброса буфера; после ожидания на нем
+    // вызывать Poll. Создается при первом вызове: без него Write не тратит системный
+    // вызов на взвод. Точность - разрешение системного таймера, а не flushDelayUs.
+    HANDLE GetFlushTimer();
+
+    DWORD GetBufferedCount() const;
+    LONG64 GetPublishedRecords() const;
+    LONG64 GetPublishedMessages() const;
+};
+
+inline MessageCoalescer::MessageCoalescer(RingBuffer& ringBuffer, DWORD delayUs, HANDLE signal)
+    : ring(ringBuffer), hSignal(signal), hFlushTimer(NULL), flushDelayUs(delayUs), flushDeadline(0), batchTopic(0),
+    batchMessages(0), publishedRecords(0), publishedMessages(0) {
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    flushDelayTicks = frequency.QuadPart * flushDelayUs / 1000000;
+    batch.reserve(ring.GetRecordSize());
+}
+
+// Последняя попытка без ожидания: деструктор не должен блокировать
+inline MessageCoalescer::~MessageCoalescer() {
+    Flush(0);
+    if (hFlushTimer) CloseHandle(hFlushTimer);
+}
+
+inline LONGLONG MessageCoalescer::Now() {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+inline bool MessageCoalescer::Write(DWORD topic, const string& message, DWORD timeoutMs) {
+    size_t entrySize = BATCH_ENTRY_HEADER + message.size();
+    size_t capacity = ring.GetRecordSize();
+
+    if (batchMessages > 0 && (topic != batchTopic || batch.size() + entrySize > capacity)) {
+        if (!Flush(timeoutMs)) return false;
+    }
+
+    // Не помещается даже в пустую пачку - обычная запись, порядок сохранен сбросом выше
+    if (entrySize > capacity || message.size() > MAXWORD) {
+        return Publish(topic, message, 1, false, timeoutMs);
+    }
+
+    if (batchMessages == 0) {
+        batchTopic = topic;
+        flushDeadline = Now() + flushDelayTicks;
+        ArmFlushTimer();
+    }
+
+    WORD length = static_cast<WORD>(message.size());
+    batch.append(reinterpret_cast<const char*>(&length), BATCH_ENTRY_HEADER);
+    batch.append(message);
+    batchMessages++;
+
+    // Сообщение уже принято: неудачный сброс повторится при следующем вызове
+    if (capacity - batch.size() <= BATCH_ENTRY_HEADER || Now() >= flushDeadline) {
+        Flush(0);
+    }
+    return true;
+}
+
+inline bool MessageCoalescer::Poll(DWORD timeoutMs) {
+    if (batchMessages == 0 || Now() < flushDeadline) return true;
+    if (Flush(timeoutMs)) return true;
+
+    // Кольцо заполнено: таймер уже сработал, взводим его на следующую попытку
+    ArmFlushTimer();
+    return false;
+}
+
+inline bool MessageCoalescer::Flush(DWORD timeoutMs) {
+    if (batchMessages == 0) return true;
+
+    bool published;
+    if (batchMessages == 1) {
+        // Одиночное сообщение пишется без обертки пачки
+        published = Publish(batchTopic, batch.substr(BATCH_ENTRY_HEADER), 1, false, timeoutMs);
+    }
+    else {
+        published = Publish(batchTopic, batch, batchMessages, true, timeoutMs);
+    }
+    if (!published) return false;
+
+    batch.clear();
+    batchMessages = 0;
+    if (hFlushTimer) CancelWaitableTimer(hFlushTimer);
+    return true;
+}
+
+inline void MessageCoalescer::ArmFlushTimer() {
+    if (!hFlushTimer) return;
+
+    // Относительный срок в единицах по 100 нс
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = -static_cast<LONGLONG>(flushDelayUs) * 10;
+    SetWaitableTimer(hFlushTimer, &dueTime, 0, NULL, NULL, FALSE);
+}
+
+inline HANDLE MessageCoalescer::GetFlushTimer() {
+    if (!hFlushTimer) {
+        hFlushTimer = CreateWaitableTimerA(NULL, FALSE, NULL);
+        if (!hFlushTimer) {
+            throw runtime_error("Cannot create coalescer flush timer");
+        }
+    }
+    return hFlushTimer;
+}
+
+inline bool MessageCoalescer::Publish(DWORD topic, const string& record, DWORD messages, bool packed,
+    DWORD timeoutMs) {
+    bool written = packed ? ring.WriteBatch(topic, record, timeoutMs) : ring.WriteMessageTo(topic, record, timeoutMs);
+    if (!written) return false;
+
+    publishedRecords++;
+    publishedMessages += messages;
+    if (hSignal) SetEvent(hSignal);
+    return true;
+}
+
+inline DWORD MessageCoalescer::GetBufferedCount() const {
+    return batchMessages;
+}
+
+inline LONG64 MessageCoalescer::GetPublishedRecords() const {
+    return publishedRecords;
+}
+
+inline LONG64 MessageCoalescer::GetPublishedMessages() const {
+    return publishedMessages;
+}
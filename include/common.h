@@ -12,13 +12,113 @@ using namespace std;
 
 const DWORD MAX_MESSAGE_SIZE = 20;
 const DWORD DEFAULT_RECORD_COUNT = 10;
+const DWORD DEFAULT_SEND_TIMEOUT = 5000;
+
+// Поведение очереди при переполнении
+enum OverflowPolicy : DWORD {
+    OVERFLOW_BLOCK = 0,             // Sender ждет освобождения места до дедлайна
+    OVERFLOW_OVERWRITE_OLDEST = 1,  // Самая старая запись вытесняется новой
+    OVERFLOW_DROP_NEWEST = 2,       // Новая запись отбрасывается, растет счетчик
+    OVERFLOW_SPILL = 3              // Sender не ждет: излишек уходит в файл и возвращается позже
+};
+
+inline const char* OverflowPolicyName(OverflowPolicy policy) {
+    switch (policy) {
+    case OVERFLOW_OVERWRITE_OLDEST: return "overwrite";
+    case OVERFLOW_DROP_NEWEST: return "drop";
+    case OVERFLOW_SPILL: return "spill";
+    default: return "block";
+    }
+}
+
+inline bool ParseOverflowPolicy(const string& name, OverflowPolicy& policy) {
+    if (name.empty() || name == "block") policy = OVERFLOW_BLOCK;
+    else if (name == "overwrite") policy = OVERFLOW_OVERWRITE_OLDEST;
+    else if (name == "drop") policy = OVERFLOW_DROP_NEWEST;
+    else if (name == "spill") policy = OVERFLOW_SPILL;
+    else return false;
+    return true;
+}
+
+const DWORD CACHE_LINE_SIZE = 64;
+const DWORD NO_CREDIT_SOURCE = 0xFFFFFFFF;
+
+// RecordHeader::owner на время списания слота RecoverStalledSlot; такого id процесса не бывает
+const DWORD SLOT_RECOVERING = 0xFFFFFFFF;
+
+// Кредиты одного Sender'а: он пишет, только пока used < granted. Таблица лежит
+// за слотами кольца; поля Sender'а и поля читателей - в разных кэш-линиях.
+struct SenderCredits {
+    alignas(CACHE_LINE_SIZE) volatile LONG64 granted;   // выдано всего, растет порциями
+    volatile LONG64 acked;                              // освобождено читателями слотов
+    alignas(CACHE_LINE_SIZE) volatile LONG64 used;      // записано Sender'ом
+    volatile LONG64 waits;                              // сколько раз Sender ждал кредита в ядре
+};
 
+// Позиции чтения и записи монотонно растут, индекс слота = позиция % totalRecords.
+// Счетчики разнесены по разным кэш-линиям, чтобы Sender и Receiver не мешали друг другу.
 struct MessageHeader {
     DWORD totalRecords;
     DWORD recordSize;
-    DWORD readIndex;
-    DWORD writeIndex;
-    DWORD messageCount;
+    DWORD slotSize;
+    DWORD overflowPolicy;
+    DWORD numaNode;
+    DWORD checksums;    // писатели добавляют CRC32C к каждой записи
+    DWORD creditSenders;    // размер таблицы кредитов; 0 - кредиты не используются
+    DWORD creditWindow;     // доля кольца одного Sender'а
+    alignas(CACHE_LINE_SIZE) volatile LONG64 writeIndex;
+    alignas(CACHE_LINE_SIZE) volatile LONG64 readIndex;
+    alignas(CACHE_LINE_SIZE) volatile LONG64 droppedCount;
+    volatile LONG64 overwrittenCount;
+    volatile LONG64 recoveredCount;
+    volatile LONG64 corruptCount;
+};
+
+// Заголовок каждого слота: sequence == 2 * позиция -> слот свободен для записи,
+// sequence == 2 * позиция + 1 -> запись опубликована и доступна для чтения.
+// Удвоение нужно, чтобы состояния не совпадали даже при одном слоте в очереди.
+struct RecordHeader {
+    volatile LONG64 sequence;
+    DWORD length;
+    DWORD flags;
+    ULONGLONG deliverAt;    // для RECORD_DELAYED - тик GetTickCount64, раньше которого не выдавать
+    DWORD checksum;         // для RECORD_CHECKSUM - CRC32C данных, flags, topic, deliverAt и source; длина - начальное значение
+    DWORD topic;            // тема или источник записи, по ней Receiver маршрутизирует без разбора текста
+    DWORD source;           // Sender, чей кредит вернется при освобождении слота
+    DWORD owner;            // процесс, захвативший слот; 0 - свободен или захват еще не отмечен
+};
+
+// Флаги записи
+const DWORD RECORD_DELAYED = 0x1;
+const DWORD RECORD_CHECKSUM = 0x2;
+const DWORD RECORD_BATCH = 0x4;     // несколько мелких сообщений: подряд [WORD длина][данные]
+
+const DWORD BATCH_ENTRY_HEADER = sizeof(WORD);
+
+// Служебные поля прочитанной записи
+struct RecordInfo {
+    LONG64 sequence;
+    ULONGLONG deliverAt;    // 0 - обычная запись
+    DWORD topic;
+    DWORD batchIndex;       // номер сообщения внутри пачки; 0 - одиночная запись или первое сообщение
+    DWORD source;
+    bool creditGranted;     // освобождение слота выдало source новую порцию кредита
+};
+
+// Состояние кредитов Sender'а для команды status
+struct CreditUsage {
+    LONG64 window;
+    LONG64 available;
+    LONG64 inFlight;
+    LONG64 used;
+    LONG64 waits;
+};
+
+// Запись нагрузочного режима Sender (--soak): номер отправителя и порядковый номер
+struct SoakRecord {
+    DWORD senderId;
+    DWORD reserved;
+    ULONG64 sequence;
 };
 
 class SyncManager {
@@ -60,6 +160,14 @@ public:
         return OpenEventA(EVENT_ALL_ACCESS, FALSE, (baseName + "_ReadyEvent_" + to_string(senderId)).c_str());
     }
 
+    HANDLE CreateCreditEvent(DWORD senderId) {
+        return CreateEventA(NULL, FALSE, FALSE, (baseName + "_CreditEvent_" + to_string(senderId)).c_str());
+    }
+
+    HANDLE OpenCreditEvent(DWORD senderId) {
+        return OpenEventA(EVENT_ALL_ACCESS, FALSE, (baseName + "_CreditEvent_" + to_string(senderId)).c_str());
+    }
+
     HANDLE CreateQueueSemaphore(LONG initialCount, LONG maximumCount) {
         return CreateSemaphoreA(NULL, initialCount, maximumCount, (baseName + "_QueueSemaphore").c_str());
     }
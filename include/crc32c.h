@@ -0,0 +1,137 @@
+﻿#pragma once
+#include "common.h"
+
+// CRC32C (полином Кастаньоли 0x1EDC6F41). Его же считают инструкции SSE4.2 и ARMv8 CRC,
+// поэтому аппаратный путь и табличный дают одинаковый результат.
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define LAB4_CRC32C_X64
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LAB4_CRC32C_TARGET
+#else
+#define LAB4_CRC32C_TARGET __attribute__((target("sse4.2")))
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define LAB4_CRC32C_ARM64
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LAB4_CRC32C_TARGET
+#else
+#include <arm_acle.h>
+#define LAB4_CRC32C_TARGET __attribute__((target("+crc")))
+#endif
+#endif
+
+const DWORD CRC32C_POLYNOMIAL = 0x82F63B78; // 0x1EDC6F41 в отраженной записи
+
+inline const DWORD* GetCrc32cTable() {
+    static DWORD table[256];
+    static bool initialized = [] {
+        for (DWORD i = 0; i < 256; i++) {
+            DWORD crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0u - (crc & 1)));
+            }
+            table[i] = crc;
+        }
+        return true;
+    }();
+    (void)initialized;
+    return table;
+}
+
+inline DWORD Crc32cSoftware(const void* data, size_t length, DWORD crc = 0) {
+    const DWORD* table = GetCrc32cTable();
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+    crc = ~crc;
+    while (length--) {
+        crc = table[(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(LAB4_CRC32C_X64) || defined(LAB4_CRC32C_ARM64)
+#define LAB4_CRC32C_HARDWARE 1
+
+// По 8 байт за инструкцию, хвост - словом и побайтно
+LAB4_CRC32C_TARGET inline DWORD Crc32cHardware(const void* data, size_t length, DWORD crc = 0) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    ULONG64 value;
+
+#ifdef LAB4_CRC32C_X64
+    ULONG64 state = ~crc;
+    for (; length >= sizeof(value); length -= sizeof(value), bytes += sizeof(value)) {
+        memcpy(&value, bytes, sizeof(value));
+        state = _mm_crc32_u64(state, value);
+    }
+    DWORD result = static_cast<DWORD>(state);
+    if (length >= sizeof(DWORD)) {
+        DWORD word;
+        memcpy(&word, bytes, sizeof(word));
+        result = _mm_crc32_u32(result, word);
+        bytes += sizeof(word);
+        length -= sizeof(word);
+    }
+    while (length--) {
+        result = _mm_crc32_u8(result, *bytes++);
+    }
+#else
+    DWORD result = ~crc;
+    for (; length >= sizeof(value); length -= sizeof(value), bytes += sizeof(value)) {
+        memcpy(&value, bytes, sizeof(value));
+        result = __crc32cd(result, value);
+    }
+    if (length >= sizeof(DWORD)) {
+        DWORD word;
+        memcpy(&word, bytes, sizeof(word));
+        result = __crc32cw(result, word);
+        bytes += sizeof(word);
+        length -= sizeof(word);
+    }
+    while (length--) {
+        result = __crc32cb(result, *bytes++);
+    }
+#endif
+
+    return ~result;
+}
+
+inline bool DetectCrc32cHardware() {
+#if defined(LAB4_CRC32C_X64) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#elif defined(LAB4_CRC32C_X64)
+    return __builtin_cpu_supports("sse4.2");
+#elif defined(_WIN32)
+    return IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE) != FALSE;
+#elif defined(__ARM_FEATURE_CRC32)
+    return true;
+#else
+    return false;
+#endif
+}
+#else
+#define LAB4_CRC32C_HARDWARE 0
+
+inline DWORD Crc32cHardware(const void* data, size_t length, DWORD crc = 0) {
+    return Crc32cSoftware(data, length, crc);
+}
+
+inline bool DetectCrc32cHardware() {
+    return false;
+}
+#endif
+
+inline bool HasCrc32cHardware() {
+    static const bool available = DetectCrc32cHardware();
+    return available;
+}
+
+// Аппаратный путь выбирается один раз; ветвление на каждый вызов предсказывается без промахов
+inline DWORD Crc32c(const void* data, size_t length, DWORD crc = 0) {
+    return HasCrc32cHardware() ? Crc32cHardware(data, length, crc) : Crc32cSoftware(data, length, crc);
+}
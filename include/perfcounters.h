@@ -0,0 +1,133 @@
+﻿#pragma once
+#include "common.h"
+#include <iomanip>
+#include <sstream>
+
+// Счетчики потока для горячих путей очереди: такты потока (QueryThreadCycleTime) и число
+// его переключений контекста (NtQuerySystemInformation) - то, что Windows отдает без прав
+// администратора. Инструкции и промахи LLC здесь не считаются: их дает только ETW-сессия
+// с источниками PMC (SeSystemProfilePrivilege), и их снимают внешним профилем WPR/xperf.
+// Счетчики читаются до и после цикла, а не на каждое сообщение: снимок переключений
+// контекста обходит все процессы системы и стоит миллисекунды.
+
+#include <winternl.h>
+
+enum PerfCounterKind {
+    PERF_CYCLES = 0,
+    PERF_CONTEXT_SWITCHES,
+    PERF_COUNTER_COUNT
+};
+
+struct PerfSample {
+    ULONG64 values[PERF_COUNTER_COUNT];
+};
+
+const NTSTATUS PERF_STATUS_INFO_LENGTH_MISMATCH = static_cast<NTSTATUS>(0xC0000004L);
+const DWORD PERF_SNAPSHOT_SIZE = 256 * 1024;
+
+// Считает поток, который создал объект; читать можно из любого потока
+class PerfCounters {
+private:
+    typedef NTSTATUS(NTAPI* QuerySystemInformation)(SYSTEM_INFORMATION_CLASS, PVOID, ULONG, PULONG);
+
+    HANDLE hThread;
+    DWORD processId;
+    DWORD threadId;
+    QuerySystemInformation querySystemInformation;
+    bool contextSwitchesAvailable;
+
+    // SYSTEM_THREAD_INFORMATION.ContextSwitches в winternl.h называется Reserved3
+    bool ReadContextSwitches(ULONG64& value) const {
+        if (!querySystemInformation) return false;
+
+        vector<BYTE> buffer(PERF_SNAPSHOT_SIZE);
+        ULONG length = 0;
+        NTSTATUS status;
+        while ((status = querySystemInformation(SystemProcessInformation, buffer.data(),
+            static_cast<ULONG>(buffer.size()), &length)) == PERF_STATUS_INFO_LENGTH_MISMATCH) {
+            buffer.resize(max<size_t>(length, buffer.size() * 2));
+        }
+        if (status < 0) return false;
+
+        const BYTE* entry = buffer.data();
+        while (true) {
+            const SYSTEM_PROCESS_INFORMATION* process = reinterpret_cast<const SYSTEM_PROCESS_INFORMATION*>(entry);
+            if (static_cast<DWORD>(reinterpret_cast<ULONG_PTR>(process->UniqueProcessId)) == processId) {
+                const SYSTEM_THREAD_INFORMATION* threads = reinterpret_cast<const SYSTEM_THREAD_INFORMATION*>(process + 1);
+                for (ULONG i = 0; i < process->NumberOfThreads; i++) {
+                    if (static_cast<DWORD>(reinterpret_cast<ULONG_PTR>(threads[i].ClientId.UniqueThread)) == threadId) {
+                        value = threads[i].Reserved3;
+                        return true;
+                    }
+                }
+                return false;
+            }
+            if (process->NextEntryOffset == 0) return false;
+            entry += process->NextEntryOffset;
+        }
+    }
+
+public:
+    PerfCounters()
+        : processId(GetCurrentProcessId()), threadId(GetCurrentThreadId()), contextSwitchesAvailable(false) {
+        hThread = GetCurrentThread();
+        DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &hThread,
+            THREAD_QUERY_LIMITED_INFORMATION, FALSE, 0);
+
+        // ntdll загружен в каждый процесс; функция берется динамически, без ntdll.lib
+        HMODULE ntdll = GetModuleHandleA("ntdll.dll");
+        querySystemInformation = ntdll
+            ? reinterpret_cast<QuerySystemInformation>(GetProcAddress(ntdll, "NtQuerySystemInformation")) : nullptr;
+
+        ULONG64 probe;
+        contextSwitchesAvailable = ReadContextSwitches(probe);
+    }
+
+    ~PerfCounters() {
+        if (hThread != GetCurrentThread()) CloseHandle(hThread);
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool IsAvailable(PerfCounterKind kind) const {
+        return kind == PERF_CYCLES || (kind == PERF_CONTEXT_SWITCHES && contextSwitchesAvailable);
+    }
+
+    PerfSample Read() const {
+        PerfSample sample = {};
+        QueryThreadCycleTime(hThread, &sample.values[PERF_CYCLES]);
+        if (contextSwitchesAvailable) {
+            ReadContextSwitches(sample.values[PERF_CONTEXT_SWITCHES]);
+        }
+        return sample;
+    }
+
+    static const char* Name(PerfCounterKind kind) {
+        return kind == PERF_CYCLES ? "cycles" : "context switches";
+    }
+
+    // "cycles/msg 312.50, context switches 3"; недоступный счетчик выводится как "n/a"
+    string DescribePerMessage(const PerfSample& start, const PerfSample& end, ULONG64 messages) const {
+        ostringstream out;
+        out << fixed << setprecision(2);
+        double count = static_cast<double>(max<ULONG64>(messages, 1));
+
+        for (int kind = 0; kind < PERF_COUNTER_COUNT; kind++) {
+            PerfCounterKind counter = static_cast<PerfCounterKind>(kind);
+            ULONG64 delta = end.values[kind] - start.values[kind];
+            out << (kind > 0 ? ", " : "") << Name(counter);
+
+            if (!IsAvailable(counter)) {
+                out << " n/a";
+            }
+            else if (counter == PERF_CONTEXT_SWITCHES) {
+                out << " " << delta;
+            }
+            else {
+                out << "/msg " << delta / count;
+            }
+        }
+        return out.str();
+    }
+};
@@ -0,0 +1,122 @@
+#pragma once
+#include "common.h"
+#include <map>
+#include <sstream>
+
+const int NO_CORE = -1;
+const int MAX_CORES = 64 * 64;  // до 64 групп по 64 логических процессора
+
+// Размещение процессов по ядрам: "r:0 s0:2 s1:4" - Receiver на ядре 0,
+// Sender 0 на ядре 2, Sender 1 на ядре 4. Незаданные участники не закрепляются.
+// Номера ядер сквозные по всем группам процессоров: при 64 ядрах в группе ядро 70 -
+// шестое во второй группе. NUMA-узел кольца берется с ядра Receiver'а; без него
+// кольцо размещается где придется (см. GetCoreNumaNode).
+struct PlacementPlan {
+    int receiverCore = NO_CORE;
+    map<DWORD, int> senderCores;
+
+    int GetSenderCore(DWORD senderId) const {
+        auto it = senderCores.find(senderId);
+        return it == senderCores.end() ? NO_CORE : it->second;
+    }
+};
+
+inline bool ParsePlacementPlan(const string& spec, PlacementPlan& plan) {
+    istringstream in(spec);
+    string token;
+
+    try {
+        while (in >> token) {
+            size_t colon = token.find(':');
+            if (colon == string::npos || colon == 0) return false;
+
+            string role = token.substr(0, colon);
+            int core = stoi(token.substr(colon + 1));
+            // Есть ли такое ядро на этой машине, проверит PinCurrentThread
+            if (core < 0 || core >= MAX_CORES) return false;
+
+            if (role == "r") {
+                plan.receiverCore = core;
+            }
+            else if (role[0] == 's') {
+                plan.senderCores[stoul(role.substr(1))] = core;
+            }
+            else {
+                return false;
+            }
+        }
+    }
+    catch (const exception&) {
+        return false;
+    }
+
+    return true;
+}
+
+// Сквозной номер ядра в группу и номер внутри нее
+inline bool GetCoreProcessorNumber(int core, PROCESSOR_NUMBER& processor) {
+    if (core < 0) return false;
+
+    DWORD index = static_cast<DWORD>(core);
+    WORD groupCount = GetActiveProcessorGroupCount();
+    for (WORD group = 0; group < groupCount; group++) {
+        DWORD groupSize = GetActiveProcessorCount(group);
+        if (index < groupSize) {
+            processor.Group = group;
+            processor.Number = static_cast<BYTE>(index);
+            processor.Reserved = 0;
+            return true;
+        }
+        index -= groupSize;
+    }
+    return false;
+}
+
+// Закрепляет текущий поток; дочерние процессы маску потока не наследуют.
+// SetThreadAffinityMask достает только до ядер группы процесса, поэтому группа задается явно
+inline bool PinCurrentThread(int core) {
+    if (core == NO_CORE) return true;
+
+    PROCESSOR_NUMBER processor;
+    if (!GetCoreProcessorNumber(core, processor)) return false;
+
+    GROUP_AFFINITY affinity = {};
+    affinity.Mask = static_cast<KAFFINITY>(1) << processor.Number;
+    affinity.Group = processor.Group;
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != FALSE;
+}
+
+inline DWORD GetCurrentNumaNode() {
+    PROCESSOR_NUMBER processor;
+    GetCurrentProcessorNumberEx(&processor);
+
+    USHORT node;
+    if (!GetNumaProcessorNodeEx(&processor, &node)) {
+        return NUMA_NO_PREFERRED_NODE;
+    }
+    return node;
+}
+
+// Узел ядра из плана, а не того, где поток оказался сейчас. Незакрепленный поток
+// мигрирует между узлами, поэтому для NO_CORE узел не выбирается
+inline DWORD GetCoreNumaNode(int core) {
+    PROCESSOR_NUMBER processor;
+    if (!GetCoreProcessorNumber(core, processor)) {
+        return NUMA_NO_PREFERRED_NODE;
+    }
+
+    USHORT node;
+    if (!GetNumaProcessorNodeEx(&processor, &node)) {
+        return NUMA_NO_PREFERRED_NODE;
+    }
+    return node;
+}
+
+inline string DescribeNumaNode(DWORD node) {
+    return node == NUMA_NO_PREFERRED_NODE ? "any" : to_string(node);
+}
+
+inline string DescribePlacement(int core) {
+    string result = core == NO_CORE ? "unpinned" : "core " + to_string(core);
+    return result + ", running on node " + DescribeNumaNode(GetCurrentNumaNode());
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "common.h"
+#include "crc32c.h"
 
 class RingBuffer {
 private:
@@ -7,25 +8,103 @@ private:
     HANDLE hFileMapping;
     MessageHeader* pHeader;
     char* pData;
+    SenderCredits* pCredits;
     string fileName;
     DWORD totalSize;
+    // Недочитанная пачка принадлежит этому объекту: одним объектом читает один поток
+    string readBatch;
+    size_t readBatchOffset;
+    RecordInfo readBatchInfo;
+    DWORD creditSource;
+
+    void InitializeLayout(DWORD recordCount, DWORD recordSize, OverflowPolicy policy, DWORD numaNode,
+        DWORD creditSenders);
+    static DWORD GetCreditTableOffset(DWORD recordCount, DWORD recordSize);
+    static void CheckCreditSenders(DWORD recordCount, DWORD creditSenders);
+    RecordHeader* GetSlot(LONG64 position) const;
+    static volatile LONG* SourceOf(RecordHeader* slot);
+    static volatile LONG* OwnerOf(RecordHeader* slot);
+    static bool IsProcessAlive(DWORD processId);
+    static DWORD GetRecordChecksum(const RecordHeader* slot, const char* data, DWORD length);
+    bool TryWrite(const string& message, ULONGLONG deliverAt, DWORD topic, DWORD flags);
+    static bool AcquireCredit(SenderCredits& credits);
+    bool IsOutOfCredit() const;
+    bool TryRead(string& message, RecordInfo& info, DWORD& flags);
+    bool ReadBatchEntry(string& message, RecordInfo& info);
+    bool ReturnCredit(DWORD source);
+    bool WriteRecord(const string& message, ULONGLONG deliverAt, DWORD topic, DWORD flags);
+    bool WriteRecord(const string& message, ULONGLONG deliverAt, DWORD topic, DWORD flags, DWORD timeoutMs);
 
 public:
-    RingBuffer(const string& name, DWORD recordCount, DWORD recordSize = MAX_MESSAGE_SIZE);
+    // numaNode - узел, на котором создатель размещает страницы кольца (обычно узел Receiver).
+    // creditSenders > 0 - кольцо делится поровну между столькими Sender'ами (см. AttachCredits)
+    RingBuffer(const string& name, DWORD recordCount, DWORD recordSize = MAX_MESSAGE_SIZE,
+        OverflowPolicy policy = OVERFLOW_BLOCK, DWORD numaNode = NUMA_NO_PREFERRED_NODE, DWORD creditSenders = 0);
+    // Кольцо внутри чужой области памяти (например, сегмента каналов); recordCount == 0 - подключиться
+    RingBuffer(void* region, DWORD recordCount, DWORD recordSize = MAX_MESSAGE_SIZE,
+        OverflowPolicy policy = OVERFLOW_BLOCK, DWORD numaNode = NUMA_NO_PREFERRED_NODE, DWORD creditSenders = 0);
     ~RingBuffer();
 
+    static DWORD GetSlotSize(DWORD recordSize);
+    static DWORD GetRequiredSize(DWORD recordCount, DWORD recordSize = MAX_MESSAGE_SIZE, DWORD creditSenders = 0);
+
     bool WriteMessage(const string& message);
+    bool WriteMessage(const string& message, DWORD timeoutMs);
+    // Отложенная запись: кольцо выдает ее сразу, срок выдерживает читатель (Receiver)
+    bool WriteDelayedMessage(const string& message, DWORD delayMs, DWORD timeoutMs = 0, DWORD topic = 0);
+    // Запись с темой; timeoutMs - как у WriteMessage(message, timeoutMs)
+    bool WriteMessageTo(DWORD topic, const string& message, DWORD timeoutMs = 0);
+    // Пачка из MessageCoalescer; читатели получают ее сообщения по одному
+    bool WriteBatch(DWORD topic, const string& batch, DWORD timeoutMs = 0);
     bool ReadMessage(string& message);
+    bool ReadMessage(string& message, LONG64& sequence);
+    bool ReadMessage(string& message, RecordInfo& info);
     bool IsEmpty() const;
     bool IsFull() const;
     DWORD GetMessageCount() const;
+    DWORD GetCapacity() const;
+    DWORD GetRecordSize() const;
+    // Разметить кольцо заново с теми же параметрами: сообщения, счетчики и кредиты
+    // сбрасываются. Только для владельца, пока к кольцу никто не подключен.
+    void Reset();
+
+    OverflowPolicy GetOverflowPolicy() const;
+    void SetOverflowPolicy(OverflowPolicy policy);
+    LONG64 GetDroppedCount() const;
+    LONG64 GetOverwrittenCount() const;
+    DWORD GetNumaNode() const;
+    LONG64 GetRecoveredCount() const;
+    bool IsChecksumEnabled() const;
+    bool SetChecksums(bool enabled);
+    LONG64 GetCorruptCount() const;
+    LONG64 GetWriteIndex() const;
+    LONG64 GetReadIndex() const;
+
+    // Кредиты: каждый Sender держит в кольце не больше своей доли, и болтливый
+    // Sender не может вытеснить остальных. Записи этого объекта расходуют кредит
+    // senderId; false - у кольца нет кредита для такого Sender'а.
+    // Доля фиксирована: recordCount / creditSenders, свободные окна молчащих Sender'ов
+    // не одалживаются. Единственный активный Sender занимает только свою долю, а
+    // остаток деления (10 записей на 3 Sender'а - одна) не достается никому. Это цена
+    // гарантии: слот для выданного кредита всегда найдется без ожидания соседей.
+    bool AttachCredits(DWORD senderId);
+    // Чей кредит расходуют записи этого объекта; NO_CREDIT_SOURCE - ничей
+    DWORD GetCreditSource() const;
+    DWORD GetCreditSenders() const;
+    LONG64 GetCredits(DWORD senderId) const;
+    bool GetCreditUsage(DWORD senderId, CreditUsage& usage) const;
+    void CountCreditWait();
+
+    bool RecoverStalledSlot();
 };
 
-inline RingBuffer::RingBuffer(const string& name, DWORD recordCount, DWORD recordSize)
-    : fileName(name), hFile(INVALID_HANDLE_VALUE), hFileMapping(NULL),
-    pHeader(nullptr), pData(nullptr) {
+inline RingBuffer::RingBuffer(const string& name, DWORD recordCount, DWORD recordSize, OverflowPolicy policy,
+    DWORD numaNode, DWORD creditSenders)
+    : fileName(name), hFile(INVALID_HANDLE_VALUE), hFileMapping(NULL), pHeader(nullptr), pData(nullptr),
+    pCredits(nullptr), readBatchOffset(0), readBatchInfo(), creditSource(NO_CREDIT_SOURCE) {
 
-    totalSize = sizeof(MessageHeader) + recordCount * recordSize;
+    CheckCreditSenders(recordCount, creditSenders);
+    totalSize = recordCount > 0 ? GetRequiredSize(recordCount, recordSize, creditSenders) : 0;
 
     if (recordCount > 0) {
         hFile = CreateFileA(name.c_str(),
@@ -55,71 +134,590 @@ inline RingBuffer::RingBuffer(const string& name, DWORD recordCount, DWORD recor
         SetEndOfFile(hFile);
     }
 
-    hFileMapping = CreateFileMappingA(hFile, NULL, PAGE_READWRITE, 0, totalSize, NULL);
+    // Для существующего файла отображаем его целиком: размер задан создателем
+    hFileMapping = CreateFileMappingNumaA(hFile, NULL, PAGE_READWRITE, 0, totalSize, NULL, numaNode);
     if (!hFileMapping) {
         CloseHandle(hFile);
         throw runtime_error("Cannot create file mapping");
     }
 
-    pHeader = static_cast<MessageHeader*>(MapViewOfFile(hFileMapping, FILE_MAP_ALL_ACCESS, 0, 0, totalSize));
+    pHeader = static_cast<MessageHeader*>(MapViewOfFileExNuma(hFileMapping, FILE_MAP_ALL_ACCESS, 0, 0, totalSize,
+        NULL, numaNode));
     if (!pHeader) {
         CloseHandle(hFileMapping);
         CloseHandle(hFile);
         throw runtime_error("Cannot map view of file");
     }
 
+    pData = reinterpret_cast<char*>(pHeader + 1);
+
     if (recordCount > 0) {
-        pHeader->totalRecords = recordCount;
-        pHeader->recordSize = recordSize;
-        pHeader->readIndex = 0;
-        pHeader->writeIndex = 0;
-        pHeader->messageCount = 0;
+        // Создатель сам касается всех страниц, чтобы они легли на его узел (first touch)
+        memset(pData, 0, totalSize - sizeof(MessageHeader));
+        InitializeLayout(recordCount, recordSize, policy, numaNode, creditSenders);
     }
+    else {
+        totalSize = GetRequiredSize(pHeader->totalRecords, pHeader->recordSize, pHeader->creditSenders);
+    }
+    pCredits = reinterpret_cast<SenderCredits*>(pData + GetCreditTableOffset(pHeader->totalRecords, pHeader->recordSize));
+}
 
+inline RingBuffer::RingBuffer(void* region, DWORD recordCount, DWORD recordSize, OverflowPolicy policy,
+    DWORD numaNode, DWORD creditSenders)
+    : hFile(INVALID_HANDLE_VALUE), hFileMapping(NULL), pHeader(static_cast<MessageHeader*>(region)),
+    pData(nullptr), pCredits(nullptr), readBatchOffset(0), readBatchInfo(), creditSource(NO_CREDIT_SOURCE) {
+
+    CheckCreditSenders(recordCount, creditSenders);
     pData = reinterpret_cast<char*>(pHeader + 1);
+
+    if (recordCount > 0) {
+        InitializeLayout(recordCount, recordSize, policy, numaNode, creditSenders);
+    }
+    totalSize = GetRequiredSize(pHeader->totalRecords, pHeader->recordSize, pHeader->creditSenders);
+    pCredits = reinterpret_cast<SenderCredits*>(pData + GetCreditTableOffset(pHeader->totalRecords, pHeader->recordSize));
 }
 
 inline RingBuffer::~RingBuffer() {
+    // Память чужой области освобождает ее владелец
+    if (hFile == INVALID_HANDLE_VALUE) return;
+
     if (pHeader) UnmapViewOfFile(pHeader);
     if (hFileMapping) CloseHandle(hFileMapping);
-    if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+    CloseHandle(hFile);
+}
+
+// Слот: заголовок записи + данные, выровненные до 8 байт
+inline DWORD RingBuffer::GetSlotSize(DWORD recordSize) {
+    return (sizeof(RecordHeader) + recordSize + 7) & ~7u;
+}
+
+// Таблица кредитов идет за слотами с начала кэш-линии; без кредитов ее нет
+inline DWORD RingBuffer::GetCreditTableOffset(DWORD recordCount, DWORD recordSize) {
+    return (recordCount * GetSlotSize(recordSize) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+}
+
+inline DWORD RingBuffer::GetRequiredSize(DWORD recordCount, DWORD recordSize, DWORD creditSenders) {
+    if (creditSenders == 0) {
+        return sizeof(MessageHeader) + recordCount * GetSlotSize(recordSize);
+    }
+    return sizeof(MessageHeader) + GetCreditTableOffset(recordCount, recordSize)
+        + creditSenders * static_cast<DWORD>(sizeof(SenderCredits));
+}
+
+// Каждому Sender'у нужен хотя бы один слот, иначе окно оказалось бы нулевым
+inline void RingBuffer::CheckCreditSenders(DWORD recordCount, DWORD creditSenders) {
+    if (creditSenders > recordCount) {
+        throw runtime_error("Queue is too small to give every sender a credit");
+    }
+}
+
+inline void RingBuffer::InitializeLayout(DWORD recordCount, DWORD recordSize, OverflowPolicy policy, DWORD numaNode,
+    DWORD creditSenders) {
+    pHeader->totalRecords = recordCount;
+    pHeader->recordSize = recordSize;
+    pHeader->slotSize = GetSlotSize(recordSize);
+    pHeader->overflowPolicy = policy;
+    pHeader->numaNode = numaNode;
+    pHeader->checksums = FALSE;
+    pHeader->creditSenders = creditSenders;
+    pHeader->creditWindow = creditSenders > 0 ? recordCount / creditSenders : 0;
+    pHeader->writeIndex = 0;
+    pHeader->readIndex = 0;
+    pHeader->droppedCount = 0;
+    pHeader->overwrittenCount = 0;
+    pHeader->recoveredCount = 0;
+    pHeader->corruptCount = 0;
+
+    for (DWORD i = 0; i < recordCount; i++) {
+        GetSlot(i)->sequence = 2 * static_cast<LONG64>(i);
+        GetSlot(i)->source = NO_CREDIT_SOURCE;
+        GetSlot(i)->owner = 0;
+    }
+
+    SenderCredits* credits = reinterpret_cast<SenderCredits*>(pData + GetCreditTableOffset(recordCount, recordSize));
+    for (DWORD i = 0; i < creditSenders; i++) {
+        credits[i].granted = pHeader->creditWindow;
+        credits[i].acked = 0;
+        credits[i].used = 0;
+        credits[i].waits = 0;
+    }
+}
+
+inline RecordHeader* RingBuffer::GetSlot(LONG64 position) const {
+    return reinterpret_cast<RecordHeader*>(pData + (position % pHeader->totalRecords) * pHeader->slotSize);
+}
+
+inline volatile LONG* RingBuffer::SourceOf(RecordHeader* slot) {
+    return reinterpret_cast<volatile LONG*>(&slot->source);
+}
+
+inline volatile LONG* RingBuffer::OwnerOf(RecordHeader* slot) {
+    return reinterpret_cast<volatile LONG*>(&slot->owner);
+}
+
+// Процесс, которого уже нет, OpenProcess не откроет; завершенный, но не закрытый - сигнален.
+// При любой другой ошибке (например, нет прав) процесс считается живым
+inline bool RingBuffer::IsProcessAlive(DWORD processId) {
+    HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, processId);
+    if (hProcess == NULL) {
+        return GetLastError() != ERROR_INVALID_PARAMETER;
+    }
+
+    bool alive = WaitForSingleObject(hProcess, 0) == WAIT_TIMEOUT;
+    CloseHandle(hProcess);
+    return alive;
+}
+
+// Сумма покрывает данные и метаданные записи: испорченные flags, topic или deliverAt
+// так же опасны, как испорченные данные. sequence и сама сумма в нее не входят.
+inline DWORD RingBuffer::GetRecordChecksum(const RecordHeader* slot, const char* data, DWORD length) {
+    DWORD crc = Crc32c(data, length, length);
+    crc = Crc32c(&slot->flags, sizeof(slot->flags), crc);
+    crc = Crc32c(&slot->topic, sizeof(slot->topic), crc);
+    crc = Crc32c(&slot->deliverAt, sizeof(slot->deliverAt), crc);
+    return Crc32c(&slot->source, sizeof(slot->source), crc);
+}
+
+// Кредит списывается CAS'ом до захвата слота: под одним senderId могут писать
+// несколько объектов и процессов, и вместе они не выйдут за окно
+inline bool RingBuffer::AcquireCredit(SenderCredits& credits) {
+    LONG64 used = ReadAcquire64(&credits.used);
+    while (used < ReadAcquire64(&credits.granted)) {
+        LONG64 observed = InterlockedCompareExchange64(&credits.used, used + 1, used);
+        if (observed == used) return true;
+        used = observed;
+    }
+    return false;
+}
+
+inline bool RingBuffer::IsOutOfCredit() const {
+    return creditSource != NO_CREDIT_SOURCE && GetCredits(creditSource) <= 0;
+}
+
+// Запись без блокировок: позиция захватывается CAS, данные публикуются через sequence
+inline bool RingBuffer::TryWrite(const string& message, ULONGLONG deliverAt, DWORD topic, DWORD flags) {
+    // Пока есть кредит, слот для этого Sender'а гарантированно найдется. Списанный
+    // кредит читатель вернет, освобождая слот, а пока запись не опубликована - сам писатель
+    SenderCredits* credits = creditSource != NO_CREDIT_SOURCE ? &pCredits[creditSource] : nullptr;
+    if (credits && !AcquireCredit(*credits)) {
+        return false;
+    }
+
+    LONG64 position = ReadAcquire64(&pHeader->writeIndex);
+
+    while (true) {
+        RecordHeader* slot = GetSlot(position);
+        LONG64 diff = ReadAcquire64(&slot->sequence) - 2 * position;
+
+        if (diff == 0) {
+            LONG64 observed = InterlockedCompareExchange64(&pHeader->writeIndex, position + 1, position);
+            if (observed == position) {
+                // Владелец отмечается до первой записи в слот: слот живого владельца
+                // RecoverStalledSlot не трогает. Неотмеченный захват он может списать -
+                // тогда позиция потеряна, а слот, возможно, уже на следующем круге
+                LONG processId = static_cast<LONG>(GetCurrentProcessId());
+                if (InterlockedCompareExchange(OwnerOf(slot), processId, 0) != 0) {
+                    position = ReadAcquire64(&pHeader->writeIndex);
+                    continue;
+                }
+                if (ReadAcquire64(&slot->sequence) != 2 * position) {
+                    InterlockedCompareExchange(OwnerOf(slot), 0, processId);
+                    position = ReadAcquire64(&pHeader->writeIndex);
+                    continue;
+                }
+
+                DWORD length = static_cast<DWORD>(min<size_t>(message.size(), pHeader->recordSize));
+                memcpy(slot + 1, message.data(), length);
+                slot->length = length;
+                slot->flags = (deliverAt ? RECORD_DELAYED : 0) | flags;
+                slot->deliverAt = deliverAt;
+                slot->topic = topic;
+                // source пишется после отметки владельца: RecoverStalledSlot по нему
+                // вернет кредит Sender'а, убитого до публикации
+                WriteRelease(SourceOf(slot), static_cast<LONG>(creditSource));
+                if (pHeader->checksums) {
+                    slot->flags |= RECORD_CHECKSUM;
+                    slot->checksum = GetRecordChecksum(slot, message.data(), length);
+                }
+                WriteRelease64(&slot->sequence, 2 * position + 1);
+                return true;
+            }
+            position = observed;
+        }
+        else if (diff < 0) {
+            // Кольцо полно - слот не захвачен, кредит возвращается неизрасходованным
+            if (credits) InterlockedDecrement64(&credits->used);
+            return false;
+        }
+        else {
+            position = ReadAcquire64(&pHeader->writeIndex);
+        }
+    }
+}
+
+inline bool RingBuffer::TryRead(string& message, RecordInfo& info, DWORD& flags) {
+    LONG64 position = ReadAcquire64(&pHeader->readIndex);
+
+    while (true) {
+        RecordHeader* slot = GetSlot(position);
+        LONG64 diff = ReadAcquire64(&slot->sequence) - (2 * position + 1);
+
+        if (diff == 0) {
+            LONG64 observed = InterlockedCompareExchange64(&pHeader->readIndex, position + 1, position);
+            if (observed == position) {
+                // Проверяем до освобождения слота: после него запись может перезаписать Sender.
+                // Нужна ли проверка, решает флаг очереди, а не бит RECORD_CHECKSUM самой
+                // записи: испорченный flags иначе мог бы выключить ее проверку
+                DWORD length = slot->length;
+                flags = slot->flags;
+                bool intact = length <= pHeader->recordSize;
+                if (intact) {
+                    message.assign(reinterpret_cast<const char*>(slot + 1), length);
+                    intact = !pHeader->checksums || GetRecordChecksum(slot, message.data(), length) == slot->checksum;
+                }
+                info.sequence = position;
+                info.deliverAt = (flags & RECORD_DELAYED) ? slot->deliverAt : 0;
+                info.topic = slot->topic;
+                info.batchIndex = 0;
+                info.source = slot->source;
+                slot->source = NO_CREDIT_SOURCE;
+                slot->owner = 0;
+                WriteRelease64(&slot->sequence, 2 * (position + pHeader->totalRecords));
+                info.creditGranted = ReturnCredit(info.source);
+
+                if (intact) return true;
+
+                // Поврежденная запись пропускается, Receiver увидит разрыв в sequence
+                InterlockedIncrement64(&pHeader->corruptCount);
+                position = ReadAcquire64(&pHeader->readIndex);
+                continue;
+            }
+            position = observed;
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            position = ReadAcquire64(&pHeader->readIndex);
+        }
+    }
 }
 
 inline bool RingBuffer::WriteMessage(const string& message) {
-    if (IsFull()) return false;
+    return WriteRecord(message, 0, 0, 0);
+}
+
+inline bool RingBuffer::WriteRecord(const string& message, ULONGLONG deliverAt, DWORD topic, DWORD flags) {
+    while (true) {
+        if (TryWrite(message, deliverAt, topic, flags)) return true;
 
-    string truncated = message.substr(0, pHeader->recordSize - 1);
-    char* record = pData + (pHeader->writeIndex * pHeader->recordSize);
+        switch (pHeader->overflowPolicy) {
+        case OVERFLOW_OVERWRITE_OLDEST: {
+            // Кончился кредит, а не место: вытеснение освободило бы чужие записи, а не долю
+            // этого Sender'а. Такая запись не удается, как в режиме block по таймауту
+            if (IsOutOfCredit()) return false;
 
-    strcpy_s(record, pHeader->recordSize, truncated.c_str());
+            // Вытесняем самую старую запись (пачку - целиком); Receiver увидит разрыв в sequence
+            string evicted;
+            RecordInfo evictedInfo;
+            DWORD evictedFlags;
+            if (TryRead(evicted, evictedInfo, evictedFlags)) {
+                InterlockedIncrement64(&pHeader->overwrittenCount);
+            }
+            else {
+                YieldProcessor();
+            }
+            break;
+        }
+        case OVERFLOW_DROP_NEWEST:
+            InterlockedIncrement64(&pHeader->droppedCount);
+            return false;
+        // OVERFLOW_SPILL: кольцо отказывает сразу, излишек забирает SpillQueue писателя
+        default:
+            return false;
+        }
+    }
+}
 
-    pHeader->writeIndex = (pHeader->writeIndex + 1) % pHeader->totalRecords;
-    pHeader->messageCount++;
+// Для OVERFLOW_BLOCK ждет освобождения места не дольше timeoutMs
+inline bool RingBuffer::WriteMessage(const string& message, DWORD timeoutMs) {
+    return WriteRecord(message, 0, 0, 0, timeoutMs);
+}
+
+inline bool RingBuffer::WriteDelayedMessage(const string& message, DWORD delayMs, DWORD timeoutMs, DWORD topic) {
+    // Тик 0 зарезервирован за обычными записями
+    return WriteRecord(message, max<ULONGLONG>(GetTickCount64() + delayMs, 1), topic, 0, timeoutMs);
+}
+
+inline bool RingBuffer::WriteMessageTo(DWORD topic, const string& message, DWORD timeoutMs) {
+    return WriteRecord(message, 0, topic, 0, timeoutMs);
+}
+
+// Обрезанная пачка не разобралась бы, поэтому слишком длинная не пишется
+inline bool RingBuffer::WriteBatch(DWORD topic, const string& batch, DWORD timeoutMs) {
+    if (batch.size() > pHeader->recordSize) return false;
+    return WriteRecord(batch, 0, topic, RECORD_BATCH, timeoutMs);
+}
+
+inline bool RingBuffer::WriteRecord(const string& message, ULONGLONG deliverAt, DWORD topic, DWORD flags,
+    DWORD timeoutMs) {
+    if (pHeader->overflowPolicy != OVERFLOW_BLOCK) {
+        return WriteRecord(message, deliverAt, topic, flags);
+    }
+
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+    DWORD spins = 0;
+
+    while (!TryWrite(message, deliverAt, topic, flags)) {
+        if (GetTickCount64() >= deadline) return false;
+
+        if (++spins < 64) {
+            YieldProcessor();
+        }
+        else {
+            Sleep(spins < 128 ? 0 : 1);
+        }
+    }
 
     return true;
 }
 
 inline bool RingBuffer::ReadMessage(string& message) {
-    if (IsEmpty()) return false;
+    RecordInfo info;
+    return ReadMessage(message, info);
+}
+
+inline bool RingBuffer::ReadMessage(string& message, LONG64& sequence) {
+    RecordInfo info;
+    if (!ReadMessage(message, info)) return false;
+    sequence = info.sequence;
+    return true;
+}
+
+// Пачка забирается из кольца целиком (слот освобождается сразу), а ее сообщения
+// выдаются по одному с общими sequence и темой и растущим batchIndex
+inline bool RingBuffer::ReadMessage(string& message, RecordInfo& info) {
+    if (ReadBatchEntry(message, info)) return true;
+
+    DWORD flags;
+    while (TryRead(message, info, flags)) {
+        if (!(flags & RECORD_BATCH)) return true;
+
+        readBatch.swap(message);
+        readBatchOffset = 0;
+        readBatchInfo = info;
+        if (ReadBatchEntry(message, info)) return true;
+    }
+    return false;
+}
 
-    char* record = pData + (pHeader->readIndex * pHeader->recordSize);
-    message = record;
+inline bool RingBuffer::ReadBatchEntry(string& message, RecordInfo& info) {
+    if (readBatchOffset >= readBatch.size()) return false;
 
-    memset(record, 0, pHeader->recordSize);
-    pHeader->readIndex = (pHeader->readIndex + 1) % pHeader->totalRecords;
-    pHeader->messageCount--;
+    size_t remaining = readBatch.size() - readBatchOffset;
+    WORD length = 0;
+    if (remaining >= BATCH_ENTRY_HEADER) {
+        memcpy(&length, readBatch.data() + readBatchOffset, BATCH_ENTRY_HEADER);
+    }
+
+    // Без контрольной суммы разорванная пачка может оказаться неразборчивой
+    if (remaining < BATCH_ENTRY_HEADER || length > remaining - BATCH_ENTRY_HEADER) {
+        InterlockedIncrement64(&pHeader->corruptCount);
+        readBatch.clear();
+        readBatchOffset = 0;
+        return false;
+    }
 
+    message.assign(readBatch, readBatchOffset + BATCH_ENTRY_HEADER, length);
+    readBatchOffset += BATCH_ENTRY_HEADER + length;
+    info = readBatchInfo;
+    readBatchInfo.batchIndex++;
+    readBatchInfo.creditGranted = false;
+
+    if (readBatchOffset == readBatch.size()) {
+        readBatch.clear();
+        readBatchOffset = 0;
+    }
     return true;
 }
 
+// Учитывает и недочитанную пачку этого объекта
 inline bool RingBuffer::IsEmpty() const {
-    return pHeader->messageCount == 0;
+    return readBatchOffset >= readBatch.size() && GetMessageCount() == 0;
 }
 
 inline bool RingBuffer::IsFull() const {
-    return pHeader->messageCount >= pHeader->totalRecords;
+    return GetMessageCount() >= pHeader->totalRecords;
 }
 
 inline DWORD RingBuffer::GetMessageCount() const {
-    return pHeader->messageCount;
-}
\ No newline at end of file
+    LONG64 readIndex = ReadAcquire64(&pHeader->readIndex);
+    LONG64 writeIndex = ReadAcquire64(&pHeader->writeIndex);
+    LONG64 count = writeIndex - readIndex;
+
+    if (count < 0) return 0;
+    if (count > pHeader->totalRecords) return pHeader->totalRecords;
+    return static_cast<DWORD>(count);
+}
+
+inline DWORD RingBuffer::GetCapacity() const {
+    return pHeader->totalRecords;
+}
+
+inline void RingBuffer::Reset() {
+    InitializeLayout(pHeader->totalRecords, pHeader->recordSize, GetOverflowPolicy(), pHeader->numaNode,
+        pHeader->creditSenders);
+    readBatch.clear();
+    readBatchOffset = 0;
+}
+
+inline DWORD RingBuffer::GetRecordSize() const {
+    return pHeader->recordSize;
+}
+
+inline OverflowPolicy RingBuffer::GetOverflowPolicy() const {
+    return static_cast<OverflowPolicy>(pHeader->overflowPolicy);
+}
+
+inline void RingBuffer::SetOverflowPolicy(OverflowPolicy policy) {
+    pHeader->overflowPolicy = policy;
+}
+
+inline LONG64 RingBuffer::GetDroppedCount() const {
+    return ReadAcquire64(&pHeader->droppedCount);
+}
+
+inline LONG64 RingBuffer::GetOverwrittenCount() const {
+    return ReadAcquire64(&pHeader->overwrittenCount);
+}
+
+inline DWORD RingBuffer::GetNumaNode() const {
+    return pHeader->numaNode;
+}
+
+inline LONG64 RingBuffer::GetRecoveredCount() const {
+    return ReadAcquire64(&pHeader->recoveredCount);
+}
+
+inline bool RingBuffer::IsChecksumEnabled() const {
+    return pHeader->checksums != FALSE;
+}
+
+// Читатель проверяет все записи по флагу очереди, поэтому переключать его можно только
+// на пустом кольце, пока Sender'ы не пишут; false - в кольце есть записи
+inline bool RingBuffer::SetChecksums(bool enabled) {
+    if (!IsEmpty()) return false;
+    pHeader->checksums = enabled ? TRUE : FALSE;
+    return true;
+}
+
+inline LONG64 RingBuffer::GetCorruptCount() const {
+    return ReadAcquire64(&pHeader->corruptCount);
+}
+
+inline LONG64 RingBuffer::GetWriteIndex() const {
+    return ReadAcquire64(&pHeader->writeIndex);
+}
+
+inline LONG64 RingBuffer::GetReadIndex() const {
+    return ReadAcquire64(&pHeader->readIndex);
+}
+
+// Списывает слот, который Sender захватил, но не опубликовал (процесс был убит
+// посреди записи). Слот живого владельца, даже надолго вытесненного, не трогается:
+// его запись продолжилась бы поверх чужой. Захват без отметки владельца списывается,
+// и такой писатель, проснувшись, уходит на следующую позицию, не касаясь слота.
+inline bool RingBuffer::RecoverStalledSlot() {
+    LONG64 position = ReadAcquire64(&pHeader->readIndex);
+    if (ReadAcquire64(&pHeader->writeIndex) <= position) return false;
+
+    RecordHeader* slot = GetSlot(position);
+    if (ReadAcquire64(&slot->sequence) != 2 * position) return false;
+
+    LONG owner = ReadAcquire(OwnerOf(slot));
+    if (owner == static_cast<LONG>(SLOT_RECOVERING)) return false;
+    if (owner != 0 && IsProcessAlive(static_cast<DWORD>(owner))) return false;
+    if (InterlockedCompareExchange(OwnerOf(slot), static_cast<LONG>(SLOT_RECOVERING), owner) != owner) {
+        return false;
+    }
+
+    // Пока мы смотрели на владельца, слот могли опубликовать, прочитать и выдать на
+    // следующий круг - тогда он не наш, возвращаем метку как была
+    if (ReadAcquire64(&slot->sequence) != 2 * position) {
+        WriteRelease(OwnerOf(slot), owner);
+        return false;
+    }
+
+    // Записавший source Sender уже списал кредит - возвращаем его, иначе окно убитого
+    // Sender'а сужалось бы на слот с каждым сбоем, пока он не встал бы навсегда
+    DWORD source = slot->source;
+    slot->source = NO_CREDIT_SOURCE;
+    slot->owner = 0;
+    WriteRelease64(&slot->sequence, 2 * (position + pHeader->totalRecords));
+
+    InterlockedCompareExchange64(&pHeader->readIndex, position + 1, position);
+    InterlockedIncrement64(&pHeader->recoveredCount);
+    ReturnCredit(source);
+    return true;
+}
+
+// Кредит возвращается при освобождении слота любым читателем. Sender'у он выдается
+// порциями по четверти окна, чтобы Receiver не будил его на каждую запись.
+inline bool RingBuffer::ReturnCredit(DWORD source) {
+    if (source >= pHeader->creditSenders) return false;
+
+    SenderCredits& credits = pCredits[source];
+    LONG64 window = pHeader->creditWindow;
+    LONG64 batch = max<LONG64>(window / 4, 1);
+    InterlockedIncrement64(&credits.acked);
+
+    // Читателей может быть несколько: выдает тот, чей CAS успел, остальные видят новую границу
+    LONG64 granted = ReadAcquire64(&credits.granted);
+    while (true) {
+        LONG64 target = ReadAcquire64(&credits.acked) + window;
+        if (target - granted < batch) return false;
+
+        LONG64 observed = InterlockedCompareExchange64(&credits.granted, target, granted);
+        if (observed == granted) return true;
+        granted = observed;
+    }
+}
+
+inline bool RingBuffer::AttachCredits(DWORD senderId) {
+    if (senderId >= pHeader->creditSenders) return false;
+    creditSource = senderId;
+    return true;
+}
+
+inline DWORD RingBuffer::GetCreditSource() const {
+    return creditSource;
+}
+
+inline DWORD RingBuffer::GetCreditSenders() const {
+    return pHeader->creditSenders;
+}
+
+inline LONG64 RingBuffer::GetCredits(DWORD senderId) const {
+    if (senderId >= pHeader->creditSenders) return 0;
+    const SenderCredits& credits = pCredits[senderId];
+    return ReadAcquire64(&credits.granted) - ReadAcquire64(&credits.used);
+}
+
+inline bool RingBuffer::GetCreditUsage(DWORD senderId, CreditUsage& usage) const {
+    if (senderId >= pHeader->creditSenders) return false;
+
+    const SenderCredits& credits = pCredits[senderId];
+    LONG64 used = ReadAcquire64(&credits.used);
+    usage.window = pHeader->creditWindow;
+    usage.available = ReadAcquire64(&credits.granted) - used;
+    usage.inFlight = used - ReadAcquire64(&credits.acked);
+    usage.used = used;
+    usage.waits = ReadAcquire64(&credits.waits);
+    return true;
+}
+
+inline void RingBuffer::CountCreditWait() {
+    if (creditSource != NO_CREDIT_SOURCE) {
+        InterlockedIncrement64(&pCredits[creditSource].waits);
+    }
+}
@@ -0,0 +1,272 @@
+﻿#pragma once
+#include "common.h"
+#include "ringbuff.h"
+#include "channels.h"
+#include <unordered_map>
+#include <deque>
+#include <functional>
+
+const DWORD RPC_RECORD_SIZE = 256;
+const DWORD DEFAULT_RPC_REQUEST_SLOTS = 1024;
+const DWORD DEFAULT_RPC_REPLY_SLOTS = 256;
+const DWORD RPC_REPLY_WRITE_TIMEOUT = 10;
+
+enum RpcStatus : DWORD {
+    RPC_OK = 0,
+    RPC_TIMEOUT = 1
+};
+
+// Заголовок каждой записи RPC, за ним идут данные запроса или ответа
+struct RpcHeader {
+    ULONG64 correlationId;
+    DWORD clientId;
+    DWORD status;
+};
+
+const DWORD RPC_MAX_PAYLOAD = RPC_RECORD_SIZE - sizeof(RpcHeader);
+
+struct RpcResponse {
+    ULONG64 correlationId;
+    RpcStatus status;
+    string payload;
+    double latencyMicros;
+};
+
+inline string EncodeRpcRecord(const RpcHeader& header, const string& payload) {
+    string record(reinterpret_cast<const char*>(&header), sizeof(header));
+    record.append(payload, 0, RPC_MAX_PAYLOAD);
+    return record;
+}
+
+inline bool DecodeRpcRecord(const string& record, RpcHeader& header, string& payload) {
+    if (record.size() < sizeof(RpcHeader)) return false;
+    memcpy(&header, record.data(), sizeof(header));
+    payload.assign(record, sizeof(RpcHeader), string::npos);
+    return true;
+}
+
+inline string RpcRequestChannel(const string& service) {
+    return service + ".req";
+}
+
+inline string RpcReplyChannel(const string& service, DWORD clientId) {
+    return service + ".rep." + to_string(clientId);
+}
+
+// Ожидание на кольцах - активное: системные вызовы съели бы весь бюджет в 10 мкс
+inline void RpcBackoff(DWORD& spins) {
+    if (++spins < 256) {
+        YieldProcessor();
+    }
+    else {
+        SwitchToThread();
+    }
+}
+
+// Сервер: одно кольцо запросов от всех клиентов, ответы - в полосу клиента
+class RpcServer {
+private:
+    ChannelSegment& segment;
+    string serviceName;
+    unique_ptr<RingBuffer> requests;
+    unordered_map<DWORD, unique_ptr<RingBuffer>> replyLanes;
+    ULONG64 droppedReplies;
+
+    RingBuffer* GetReplyLane(DWORD clientId) {
+        auto it = replyLanes.find(clientId);
+        if (it != replyLanes.end()) return it->second.get();
+
+        auto lane = segment.OpenChannel(RpcReplyChannel(serviceName, clientId));
+        if (!lane) return nullptr;
+
+        RingBuffer* result = lane.get();
+        replyLanes[clientId] = move(lane);
+        return result;
+    }
+
+public:
+    typedef function<void(const string& request, string& reply)> Handler;
+
+    RpcServer(ChannelSegment& channelSegment, const string& service,
+        DWORD requestSlots = DEFAULT_RPC_REQUEST_SLOTS)
+        : segment(channelSegment), serviceName(service), droppedReplies(0) {
+        requests = segment.CreateChannel(RpcRequestChannel(service), requestSlots, RPC_RECORD_SIZE);
+    }
+
+    // Обрабатывает до maxRequests запросов без ожидания, возвращает их количество
+    DWORD Poll(const Handler& handler, DWORD maxRequests = 64) {
+        DWORD served = 0;
+        string record, request, reply;
+        RpcHeader header;
+
+        while (served < maxRequests && requests->ReadMessage(record)) {
+            if (!DecodeRpcRecord(record, header, request)) continue;
+
+            reply.clear();
+            handler(request, reply);
+
+            RingBuffer* lane = GetReplyLane(header.clientId);
+            if (lane) {
+                header.status = RPC_OK;
+                string response = EncodeRpcRecord(header, reply);
+                // Клиент, который не разбирает свою полосу, не должен останавливать сервер:
+                // ответ отбрасывается, запрос у клиента завершится по таймауту
+                ULONGLONG deadline = GetTickCount64() + RPC_REPLY_WRITE_TIMEOUT;
+                DWORD spins = 0;
+                while (!lane->WriteMessage(response)) {
+                    if (GetTickCount64() >= deadline) {
+                        droppedReplies++;
+                        break;
+                    }
+                    RpcBackoff(spins);
+                }
+            }
+            served++;
+        }
+
+        return served;
+    }
+
+    ULONG64 GetDroppedReplies() const {
+        return droppedReplies;
+    }
+};
+
+// Клиент: своя полоса ответов, много одновременных запросов (конвейер)
+class RpcClient {
+private:
+    struct PendingCall {
+        LONGLONG startTicks;
+        ULONGLONG deadline;
+    };
+
+    DWORD clientId;
+    ULONG64 nextCorrelationId;
+    unique_ptr<RingBuffer> requests;
+    unique_ptr<RingBuffer> replies;
+    unordered_map<ULONG64, PendingCall> pending;
+    deque<RpcResponse> completed;
+    ULONGLONG lastTimeoutScan;
+    LONGLONG ticksPerSecond;
+
+    bool PollReplies(RpcResponse& response) {
+        string record;
+        RpcHeader header;
+
+        while (replies->ReadMessage(record)) {
+            auto it = DecodeRpcRecord(record, header, response.payload)
+                ? pending.find(header.correlationId) : pending.end();
+            // Ответ на уже истекший запрос отбрасываем
+            if (it == pending.end()) continue;
+
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            response.correlationId = header.correlationId;
+            response.status = static_cast<RpcStatus>(header.status);
+            response.latencyMicros = (now.QuadPart - it->second.startTicks) * 1e6 / ticksPerSecond;
+            pending.erase(it);
+            return true;
+        }
+
+        // Таймауты проверяем не чаще раза в тик, чтобы не обходить pending на каждом опросе
+        ULONGLONG tick = GetTickCount64();
+        if (tick == lastTimeoutScan) return false;
+
+        for (auto it = pending.begin(); it != pending.end(); ++it) {
+            if (tick >= it->second.deadline) {
+                response.correlationId = it->first;
+                response.status = RPC_TIMEOUT;
+                response.payload.clear();
+                response.latencyMicros = 0;
+                pending.erase(it);
+                return true;
+            }
+        }
+
+        lastTimeoutScan = tick;
+        return false;
+    }
+
+public:
+    RpcClient(ChannelSegment& segment, const string& service, DWORD id,
+        DWORD replySlots = DEFAULT_RPC_REPLY_SLOTS)
+        : clientId(id), lastTimeoutScan(0) {
+
+        requests = segment.OpenChannel(RpcRequestChannel(service));
+        if (!requests) {
+            throw runtime_error("RPC service not found: " + service);
+        }
+        replies = segment.CreateChannel(RpcReplyChannel(service, id), replySlots, RPC_RECORD_SIZE);
+
+        // Полоса могла остаться от прошлого клиента с тем же id: его ответы выбрасываем,
+        // а старшие биты correlation ID берем свои, чтобы запоздавший ответ ни с чем не совпал
+        string stale;
+        while (replies->ReadMessage(stale)) {
+        }
+
+        LARGE_INTEGER frequency, now;
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&now);
+        ticksPerSecond = frequency.QuadPart;
+
+        DWORD epoch = static_cast<DWORD>(now.QuadPart) ^ (GetCurrentProcessId() << 16);
+        nextCorrelationId = (static_cast<ULONG64>(epoch) << 32) | 1;
+    }
+
+    // Забирает один готовый ответ или истекший по таймауту запрос
+    bool Poll(RpcResponse& response) {
+        if (!completed.empty()) {
+            // Отложенные ответы отдаются в порядке поступления
+            response = move(completed.front());
+            completed.pop_front();
+            return true;
+        }
+
+        return PollReplies(response);
+    }
+
+    // Ставит запрос в очередь; 0 - кольцо запросов заполнено
+    ULONG64 Send(const string& request, DWORD timeoutMs = DEFAULT_SEND_TIMEOUT) {
+        RpcHeader header = { nextCorrelationId, clientId, RPC_OK };
+        string record = EncodeRpcRecord(header, request);
+
+        // Время засекается до записи: она входит в задержку туда и обратно
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        if (!requests->WriteMessage(record)) {
+            return 0;
+        }
+
+        pending[header.correlationId] = { now.QuadPart, GetTickCount64() + timeoutMs };
+        return nextCorrelationId++;
+    }
+
+    // Синхронный вызов поверх Send/Poll
+    bool Call(const string& request, string& reply, DWORD timeoutMs = DEFAULT_SEND_TIMEOUT,
+        double* latencyMicros = nullptr) {
+        ULONG64 correlationId = Send(request, timeoutMs);
+        if (!correlationId) return false;
+
+        RpcResponse response;
+        DWORD spins = 0;
+        while (true) {
+            if (!PollReplies(response)) {
+                RpcBackoff(spins);
+                continue;
+            }
+            if (response.correlationId != correlationId) {
+                // Ответ на другой запрос конвейера вернет следующий Poll
+                completed.push_back(move(response));
+                continue;
+            }
+
+            if (latencyMicros) *latencyMicros = response.latencyMicros;
+            reply = response.payload;
+            return response.status == RPC_OK;
+        }
+    }
+
+    size_t GetPendingCount() const {
+        return pending.size();
+    }
+};
@@ -0,0 +1,357 @@
+﻿#pragma once
+#include "common.h"
+#include "ringbuff.h"
+#include <thread>
+#include <mutex>
+
+const DWORD SPILL_BATCH_BYTES = 256 * 1024;
+const DWORD SPILL_CHUNK_BYTES = 256 * 1024;
+const DWORD SPILL_POLL_INTERVAL = 1;
+const DWORD SPILL_FILE_MAGIC = 0x4C505342; // "BSPL"
+
+// Начало файла сброса: смещение первого еще не возвращенного в кольцо сообщения
+struct SpillFileHeader {
+    DWORD magic;
+    DWORD reserved;
+    LONG64 readOffset;
+};
+
+// Заголовок сообщения в файле сброса; за ним length байт данных
+struct SpillRecordHeader {
+    DWORD length;
+    DWORD topic;
+    ULONGLONG deliverAt;    // абсолютный тик GetTickCount64; 0 - обычное сообщение
+};
+
+// Сброс излишка на диск (OVERFLOW_SPILL). Пока кольцо принимает, сообщения идут
+// прямо в него. Когда оно заполнено, сообщения копятся в памяти, а фоновый поток
+// дописывает их в файл крупными последовательными блоками и, как только в кольце
+// появляется место, возвращает их в исходном порядке. Пока в файле что-то есть,
+// новые сообщения тоже идут через него, чтобы не обогнать старые.
+// Порядок сохраняется для одного писателя: у каждого Sender'а свой файл.
+// Недоставленные сообщения переживают перезапуск: новый SpillQueue на том же файле
+// сначала возвращает в кольцо их. Смещение чтения сохраняется после каждого блока,
+// поэтому после аварийного завершения последний блок может прийти повторно.
+class SpillQueue {
+private:
+    RingBuffer& ring;
+    HANDLE hSignal;
+    HANDLE hWakeEvent;
+    HANDLE hFile;
+    string filePath;
+
+    mutex pendingLock;
+    string pending;             // еще не записано на диск, под pendingLock
+    volatile LONG spilling;     // 1 - новые сообщения идут в сброс, а не в кольцо
+    volatile LONG stopping;
+    volatile LONG64 spilledCount;
+    volatile LONG64 replayedCount;
+
+    // Принадлежат фоновому потоку
+    LONG64 fileWriteOffset;
+    LONG64 fileReadOffset;
+    string chunk;
+    size_t chunkOffset;
+    thread worker;
+
+    void Run();
+    void LoadFile();
+    void SaveReadOffset();
+    bool WritePending();
+    bool Replay();
+    bool ReadChunk();
+    void Append(DWORD topic, const string& message, ULONGLONG deliverAt);
+
+public:
+    // hSignal - событие, которое взводится после каждого возвращенного в кольцо блока (NULL - не нужно)
+    SpillQueue(RingBuffer& ringBuffer, const string& path, HANDLE signal = NULL);
+    ~SpillQueue();
+
+    SpillQueue(const SpillQueue&) = delete;
+    SpillQueue& operator=(const SpillQueue&) = delete;
+
+    // Принимает сообщение всегда, не дожидаясь ни кольца, ни диска
+    void Write(DWORD topic, const string& message, DWORD delayMs = 0);
+    // Ждет, пока все сброшенные сообщения вернутся в кольцо
+    bool WaitDrained(DWORD timeoutMs);
+
+    bool IsSpilling() const;
+    LONG64 GetSpilledCount() const;
+    LONG64 GetReplayedCount() const;
+    LONG64 GetPendingCount() const;
+    const string& GetFilePath() const;
+};
+
+inline SpillQueue::SpillQueue(RingBuffer& ringBuffer, const string& path, HANDLE signal)
+    : ring(ringBuffer), hSignal(signal), hWakeEvent(NULL), hFile(INVALID_HANDLE_VALUE), filePath(path),
+    spilling(0), stopping(0), spilledCount(0), replayedCount(0), fileWriteOffset(0), fileReadOffset(0),
+    chunkOffset(0) {
+
+    hFile = CreateFileA(path.c_str(),
+        GENERIC_READ | GENERIC_WRITE,
+        0,
+        NULL,
+        OPEN_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+        NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        throw runtime_error("Cannot create spill file: " + path);
+    }
+    LoadFile();
+
+    hWakeEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if (!hWakeEvent) {
+        CloseHandle(hFile);
+        throw runtime_error("Cannot create spill wake event");
+    }
+
+    pending.reserve(SPILL_BATCH_BYTES);
+    worker = thread(&SpillQueue::Run, this);
+}
+
+// Недоставленные сообщения остаются в файле до следующего запуска; пустой файл удаляется
+inline SpillQueue::~SpillQueue() {
+    InterlockedExchange(&stopping, 1);
+    SetEvent(hWakeEvent);
+    worker.join();
+
+    CloseHandle(hWakeEvent);
+    CloseHandle(hFile);
+    if (GetPendingCount() == 0) {
+        DeleteFileA(filePath.c_str());
+    }
+}
+
+// Остаток прошлого запуска: недочитанные сообщения считаются сброшенными в этом,
+// оборванная при сбое последняя запись отрезается
+inline void SpillQueue::LoadFile() {
+    SpillFileHeader header = {};
+    LARGE_INTEGER size;
+    DWORD bytes = 0;
+    bool valid = GetFileSizeEx(hFile, &size) && size.QuadPart >= static_cast<LONG64>(sizeof(header))
+        && ReadFile(hFile, &header, sizeof(header), &bytes, NULL) && bytes == sizeof(header)
+        && header.magic == SPILL_FILE_MAGIC && header.readOffset >= static_cast<LONG64>(sizeof(header))
+        && header.readOffset <= size.QuadPart;
+
+    fileReadOffset = fileWriteOffset = sizeof(header);
+    if (valid) {
+        LONG64 offset = header.readOffset;
+        LONG64 records = 0;
+        SpillRecordHeader record;
+        LARGE_INTEGER position;
+        position.QuadPart = offset;
+        while (offset + static_cast<LONG64>(sizeof(record)) <= size.QuadPart
+            && SetFilePointerEx(hFile, position, NULL, FILE_BEGIN)
+            && ReadFile(hFile, &record, sizeof(record), &bytes, NULL) && bytes == sizeof(record)
+            && offset + static_cast<LONG64>(sizeof(record) + record.length) <= size.QuadPart) {
+            offset += sizeof(record) + record.length;
+            position.QuadPart = offset;
+            records++;
+        }
+
+        if (records > 0) {
+            fileReadOffset = header.readOffset;
+            fileWriteOffset = offset;
+            spilledCount = records;
+            spilling = 1;
+        }
+    }
+
+    LARGE_INTEGER end;
+    end.QuadPart = fileWriteOffset;
+    SetFilePointerEx(hFile, end, NULL, FILE_BEGIN);
+    SetEndOfFile(hFile);
+    SaveReadOffset();
+}
+
+inline void SpillQueue::SaveReadOffset() {
+    SpillFileHeader header = { SPILL_FILE_MAGIC, 0, fileReadOffset };
+    LARGE_INTEGER start = {};
+    DWORD bytes = 0;
+    if (SetFilePointerEx(hFile, start, NULL, FILE_BEGIN)) {
+        WriteFile(hFile, &header, sizeof(header), &bytes, NULL);
+    }
+}
+
+inline void SpillQueue::Write(DWORD topic, const string& message, DWORD delayMs) {
+    if (!ReadAcquire(&spilling)) {
+        bool written = delayMs > 0 ? ring.WriteDelayedMessage(message, delayMs, 0, topic)
+            : ring.WriteMessageTo(topic, message);
+        if (written) return;
+    }
+
+    // Кольцо все равно обрезало бы запись, на диск незачем писать лишнее.
+    // Срок отложенного сообщения считается от отправки, а не от возврата в кольцо.
+    Append(topic, message.substr(0, ring.GetRecordSize()),
+        delayMs > 0 ? max<ULONGLONG>(GetTickCount64() + delayMs, 1) : 0);
+}
+
+inline void SpillQueue::Append(DWORD topic, const string& message, ULONGLONG deliverAt) {
+    SpillRecordHeader header = { static_cast<DWORD>(message.size()), topic, deliverAt };
+    size_t pendingSize;
+    {
+        lock_guard<mutex> guard(pendingLock);
+        // Флаг ставится под замком: поток снимает его под тем же замком, только убедившись, что все пусто
+        InterlockedExchange(&spilling, 1);
+        pending.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        pending.append(message);
+        pendingSize = pending.size();
+    }
+    InterlockedIncrement64(&spilledCount);
+
+    // Поток просыпается сам раз в SPILL_POLL_INTERVAL; будим раньше только полный блок
+    if (pendingSize >= SPILL_BATCH_BYTES) {
+        SetEvent(hWakeEvent);
+    }
+}
+
+inline void SpillQueue::Run() {
+    while (true) {
+        bool stop = ReadAcquire(&stopping) != 0;
+        WritePending();
+        if (stop) return;
+
+        if (ReadAcquire(&spilling)) {
+            Replay();
+        }
+        WaitForSingleObject(hWakeEvent, SPILL_POLL_INTERVAL);
+    }
+}
+
+// Одна последовательная запись на весь накопленный блок
+inline bool SpillQueue::WritePending() {
+    string batch;
+    {
+        lock_guard<mutex> guard(pendingLock);
+        if (pending.empty()) return true;
+        batch.swap(pending);
+        pending.reserve(SPILL_BATCH_BYTES);
+    }
+
+    LARGE_INTEGER offset;
+    offset.QuadPart = fileWriteOffset;
+    size_t written = 0;
+    while (written < batch.size()) {
+        DWORD portion = static_cast<DWORD>(min<size_t>(batch.size() - written, MAXDWORD));
+        DWORD bytes = 0;
+        if (!SetFilePointerEx(hFile, offset, NULL, FILE_BEGIN)
+            || !WriteFile(hFile, batch.data() + written, portion, &bytes, NULL) || bytes == 0) {
+            // Диск недоступен: блок возвращается в начало очереди, повторим на следующем проходе
+            lock_guard<mutex> guard(pendingLock);
+            pending.insert(0, batch, written, string::npos);
+            fileWriteOffset = offset.QuadPart;
+            return false;
+        }
+        written += bytes;
+        offset.QuadPart += bytes;
+    }
+
+    fileWriteOffset = offset.QuadPart;
+    return true;
+}
+
+inline bool SpillQueue::ReadChunk() {
+    chunk.erase(0, chunkOffset);
+    chunkOffset = 0;
+
+    LONG64 unread = fileWriteOffset - fileReadOffset - static_cast<LONG64>(chunk.size());
+    if (unread <= 0) return false;
+
+    size_t previous = chunk.size();
+    DWORD portion = static_cast<DWORD>(min<LONG64>(unread, SPILL_CHUNK_BYTES));
+    chunk.resize(previous + portion);
+
+    LARGE_INTEGER offset;
+    offset.QuadPart = fileReadOffset + static_cast<LONG64>(previous);
+    DWORD bytes = 0;
+    if (!SetFilePointerEx(hFile, offset, NULL, FILE_BEGIN)
+        || !ReadFile(hFile, &chunk[previous], portion, &bytes, NULL)) {
+        bytes = 0;
+    }
+    chunk.resize(previous + bytes);
+    return bytes > 0;
+}
+
+// Возвращает сообщения в кольцо, пока в нем есть место
+inline bool SpillQueue::Replay() {
+    DWORD replayed = 0;
+    string message;
+
+    while (true) {
+        size_t available = chunk.size() - chunkOffset;
+        SpillRecordHeader header;
+        if (available >= sizeof(header)) {
+            memcpy(&header, chunk.data() + chunkOffset, sizeof(header));
+        }
+
+        if (available < sizeof(header) || available - sizeof(header) < header.length) {
+            if (ReadChunk()) continue;
+
+            // Файл дочитан: сброс закончен, если за это время не пришло новое
+            lock_guard<mutex> guard(pendingLock);
+            if (pending.empty() && fileReadOffset == fileWriteOffset) {
+                fileReadOffset = fileWriteOffset = sizeof(SpillFileHeader);
+                chunk.clear();
+                chunkOffset = 0;
+                SetFilePointer(hFile, sizeof(SpillFileHeader), NULL, FILE_BEGIN);
+                SetEndOfFile(hFile);
+                SaveReadOffset();
+                InterlockedExchange(&spilling, 0);
+            }
+            break;
+        }
+
+        message.assign(chunk, chunkOffset + sizeof(header), header.length);
+        bool written;
+        if (header.deliverAt > 0) {
+            ULONGLONG now = GetTickCount64();
+            DWORD delay = header.deliverAt > now ? static_cast<DWORD>(header.deliverAt - now) : 0;
+            written = ring.WriteDelayedMessage(message, delay, 0, header.topic);
+        }
+        else {
+            written = ring.WriteMessageTo(header.topic, message);
+        }
+        if (!written) break;
+
+        chunkOffset += sizeof(header) + header.length;
+        fileReadOffset += sizeof(header) + header.length;
+        replayed++;
+    }
+
+    if (replayed > 0) {
+        SaveReadOffset();
+        InterlockedAdd64(&replayedCount, replayed);
+        if (hSignal) SetEvent(hSignal);
+    }
+    return replayed > 0;
+}
+
+inline bool SpillQueue::WaitDrained(DWORD timeoutMs) {
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+    while (ReadAcquire(&spilling)) {
+        if (GetTickCount64() >= deadline) return false;
+        SetEvent(hWakeEvent);
+        Sleep(SPILL_POLL_INTERVAL);
+    }
+    return true;
+}
+
+inline bool SpillQueue::IsSpilling() const {
+    return ReadAcquire(&spilling) != 0;
+}
+
+inline LONG64 SpillQueue::GetSpilledCount() const {
+    return ReadAcquire64(&spilledCount);
+}
+
+inline LONG64 SpillQueue::GetReplayedCount() const {
+    return ReadAcquire64(&replayedCount);
+}
+
+inline LONG64 SpillQueue::GetPendingCount() const {
+    return GetSpilledCount() - GetReplayedCount();
+}
+
+inline const string& SpillQueue::GetFilePath() const {
+    return filePath;
+}
@@ -0,0 +1,210 @@
+﻿#pragma once
+#include "common.h"
+
+const DWORD TIMER_WHEEL_LEVELS = 4;
+const DWORD TIMER_WHEEL_BITS = 8;
+const DWORD TIMER_WHEEL_SLOTS = 1 << TIMER_WHEEL_BITS;
+const DWORD TIMER_NIL = 0xFFFFFFFF;
+const DWORD DEFAULT_TIMER_CAPACITY = 1 << 16;
+// Наибольшая задержка, которую покрывают уровни колеса (~49 суток при тике в 1 мс)
+const ULONGLONG MAX_TIMER_DELAY = (1ull << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1;
+
+struct DueMessage {
+    DWORD topic;
+    string message;
+};
+
+// Иерархическое колесо таймеров: 4 уровня по 256 слотов, тик - 1 мс GetTickCount64.
+// Таймер попадает на уровень по величине задержки и опускается ниже, когда младший
+// уровень проходит полный оборот, поэтому вставка и срабатывание - O(1).
+// Узлы и тексты сообщений лежат в пуле, выделенном при создании: память ограничена
+// емкостью, а при заполненном пуле Schedule возвращает false.
+class TimingWheel {
+private:
+    struct TimerNode {
+        ULONGLONG dueTick;
+        DWORD next;
+        DWORD length;
+        DWORD topic;
+    };
+
+    struct TimerList {
+        DWORD head;
+        DWORD tail;
+    };
+
+    vector<TimerNode> nodes;
+    vector<char> payloads;
+    DWORD messageSize;
+    DWORD freeHead;
+    DWORD pendingCount;
+    ULONGLONG currentTick;
+    TimerList slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    DWORD levelCounts[TIMER_WHEEL_LEVELS];
+    TimerList expired;  // наступившие таймеры ждут выдачи в Advance
+
+    void Append(TimerList& list, DWORD index);
+    void Place(DWORD index);
+    void Cascade(DWORD level);
+    DWORD Release(TimerList& list, vector<DueMessage>& due);
+
+public:
+    TimingWheel(DWORD capacity = DEFAULT_TIMER_CAPACITY, DWORD recordSize = MAX_MESSAGE_SIZE,
+        ULONGLONG startTick = GetTickCount64());
+
+    bool Schedule(ULONGLONG dueTick, const string& message, DWORD topic = 0);
+    // Продвигает колесо до nowTick и дописывает в due все наступившие сообщения разом
+    DWORD Advance(ULONGLONG nowTick, vector<DueMessage>& due);
+
+    DWORD GetPendingCount() const;
+    DWORD GetCapacity() const;
+    ULONGLONG GetCurrentTick() const;
+};
+
+inline TimingWheel::TimingWheel(DWORD capacity, DWORD recordSize, ULONGLONG startTick)
+    : nodes(capacity), payloads(static_cast<size_t>(capacity) * recordSize), messageSize(recordSize),
+    freeHead(capacity > 0 ? 0 : TIMER_NIL), pendingCount(0), currentTick(startTick) {
+
+    for (DWORD i = 0; i < capacity; i++) {
+        nodes[i].next = i + 1 < capacity ? i + 1 : TIMER_NIL;
+    }
+
+    for (DWORD level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (DWORD slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            slots[level][slot] = { TIMER_NIL, TIMER_NIL };
+        }
+        levelCounts[level] = 0;
+    }
+    expired = { TIMER_NIL, TIMER_NIL };
+}
+
+// Списки слотов - FIFO, чтобы сообщения с одним сроком выходили в порядке постановки
+inline void TimingWheel::Append(TimerList& list, DWORD index) {
+    nodes[index].next = TIMER_NIL;
+    if (list.tail == TIMER_NIL) {
+        list.head = index;
+    }
+    else {
+        nodes[list.tail].next = index;
+    }
+    list.tail = index;
+}
+
+// Уровень выбирается по оставшейся задержке, слот - по разрядам срока на этом уровне
+inline void TimingWheel::Place(DWORD index) {
+    ULONGLONG dueTick = nodes[index].dueTick;
+    if (dueTick <= currentTick) {
+        Append(expired, index);
+        return;
+    }
+
+    ULONGLONG delta = dueTick - currentTick;
+    DWORD level = 0;
+    while (level + 1 < TIMER_WHEEL_LEVELS && (delta >> (TIMER_WHEEL_BITS * (level + 1))) != 0) {
+        level++;
+    }
+
+    DWORD slot = static_cast<DWORD>(dueTick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    Append(slots[level][slot], index);
+    levelCounts[level]++;
+}
+
+// Переносит текущий слот уровня на младшие уровни
+inline void TimingWheel::Cascade(DWORD level) {
+    DWORD slot = static_cast<DWORD>(currentTick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    TimerList list = slots[level][slot];
+    slots[level][slot] = { TIMER_NIL, TIMER_NIL };
+
+    for (DWORD index = list.head; index != TIMER_NIL;) {
+        DWORD next = nodes[index].next;
+        levelCounts[level]--;
+        Place(index);
+        index = next;
+    }
+}
+
+inline DWORD TimingWheel::Release(TimerList& list, vector<DueMessage>& due) {
+    DWORD released = 0;
+
+    for (DWORD index = list.head; index != TIMER_NIL;) {
+        TimerNode& node = nodes[index];
+        due.push_back({ node.topic, string(&payloads[static_cast<size_t>(index) * messageSize], node.length) });
+
+        DWORD next = node.next;
+        node.next = freeHead;
+        freeHead = index;
+        index = next;
+        released++;
+    }
+
+    list = { TIMER_NIL, TIMER_NIL };
+    pendingCount -= released;
+    return released;
+}
+
+inline bool TimingWheel::Schedule(ULONGLONG dueTick, const string& message, DWORD topic) {
+    if (freeHead == TIMER_NIL || dueTick > currentTick + MAX_TIMER_DELAY) {
+        return false;
+    }
+
+    DWORD index = freeHead;
+    TimerNode& node = nodes[index];
+    freeHead = node.next;
+
+    node.dueTick = dueTick;
+    node.topic = topic;
+    node.length = static_cast<DWORD>(min<size_t>(message.size(), messageSize));
+    memcpy(&payloads[static_cast<size_t>(index) * messageSize], message.data(), node.length);
+
+    Place(index);
+    pendingCount++;
+    return true;
+}
+
+inline DWORD TimingWheel::Advance(ULONGLONG nowTick, vector<DueMessage>& due) {
+    DWORD released = Release(expired, due);
+
+    while (currentTick < nowTick) {
+        // Пустые младшие уровни пропускаем целыми оборотами, а не по одному тику
+        ULONGLONG step = 1;
+        for (DWORD level = 0; level < TIMER_WHEEL_LEVELS && levelCounts[level] == 0; level++) {
+            step <<= TIMER_WHEEL_BITS;
+        }
+
+        ULONGLONG nextTick = (currentTick | (step - 1)) + 1;
+        if (nextTick > nowTick) {
+            currentTick = nowTick;
+            break;
+        }
+        currentTick = nextTick;
+
+        // На границе оборота старшие уровни спускаются первыми
+        DWORD top = 0;
+        while (top + 1 < TIMER_WHEEL_LEVELS
+            && (currentTick & ((1ull << (TIMER_WHEEL_BITS * (top + 1))) - 1)) == 0) {
+            top++;
+        }
+        for (DWORD level = top; level > 0; level--) {
+            Cascade(level);
+        }
+
+        DWORD fired = Release(slots[0][currentTick & (TIMER_WHEEL_SLOTS - 1)], due);
+        levelCounts[0] -= fired;
+        released += fired;
+        released += Release(expired, due);
+    }
+
+    return released;
+}
+
+inline DWORD TimingWheel::GetPendingCount() const {
+    return pendingCount;
+}
+
+inline DWORD TimingWheel::GetCapacity() const {
+    return static_cast<DWORD>(nodes.size());
+}
+
+inline ULONGLONG TimingWheel::GetCurrentTick() const {
+    return currentTick;
+}
@@ -0,0 +1,207 @@
+﻿#pragma once
+#include "common.h"
+#include "ringbuff.h"
+#include <functional>
+
+const DWORD NO_TOPIC_HANDLER = 0xFFFFFFFF;
+const DWORD DEFAULT_ROUTE_BATCH = 64;
+
+// Отложенная запись, срок которой еще не наступил: ее выдерживает вызывающий
+struct DelayedRecord {
+    string message;
+    RecordInfo info;
+};
+
+// Индекс подписок Receiver: тема записи -> обработчик (или своя подочередь).
+// Хэш-таблица с открытой адресацией и линейным пробированием, заполнена не больше
+// чем наполовину, поэтому поиск - O(1) на сообщение при любом числе тем.
+class TopicRouter {
+public:
+    typedef function<void(DWORD topic, const string& message)> Handler;
+    // Видит каждую вычитанную запись до раздачи: sequence, источник и выданный кредит
+    typedef function<void(const RecordInfo& info)> ReadObserver;
+
+private:
+    struct TopicRoute {
+        DWORD topic;
+        DWORD handlerId;    // NO_TOPIC_HANDLER - слот пуст
+    };
+
+    vector<TopicRoute> table;
+    DWORD shift;
+    DWORD routeCount;
+    vector<Handler> handlers;
+    DWORD defaultHandler;
+    ULONG64 filteredCount;
+    string record;
+
+    // Фибоначчиево хэширование: старшие биты произведения перемешаны лучше младших
+    DWORD HomeSlot(DWORD topic) const {
+        return static_cast<DWORD>((topic * 2654435769u) >> shift);
+    }
+
+    DWORD Mask() const {
+        return static_cast<DWORD>(table.size() - 1);
+    }
+
+    void Rehash(size_t capacity);
+
+public:
+    TopicRouter(DWORD expectedTopics = 64);
+
+    DWORD AddHandler(Handler handler);
+    void Subscribe(DWORD topic, DWORD handlerId);
+    bool Unsubscribe(DWORD topic);
+    void Clear();
+    // Обработчик тем без подписки; NO_TOPIC_HANDLER - такие сообщения отбрасываются
+    void SetDefaultHandler(DWORD handlerId);
+
+    DWORD FindHandler(DWORD topic) const;
+    bool Route(DWORD topic, const string& message);
+    // Вычитывает из кольца до maxRecords записей и раздает их обработчикам. Отложенные
+    // записи с будущим deliverAt не раздаются, а дописываются в notDue
+    DWORD RouteBatch(RingBuffer& ring, vector<DelayedRecord>& notDue, DWORD maxRecords = DEFAULT_ROUTE_BATCH,
+        const ReadObserver& observer = nullptr);
+
+    DWORD GetSubscriptionCount() const;
+    bool HasDefaultHandler() const;
+    ULONG64 GetFilteredCount() const;
+};
+
+inline TopicRouter::TopicRouter(DWORD expectedTopics)
+    : shift(32), routeCount(0), defaultHandler(NO_TOPIC_HANDLER), filteredCount(0) {
+    size_t capacity = 16;
+    while (capacity < 2 * static_cast<size_t>(expectedTopics)) capacity <<= 1;
+    Rehash(capacity);
+}
+
+inline void TopicRouter::Rehash(size_t capacity) {
+    vector<TopicRoute> previous;
+    previous.swap(table);
+    table.assign(capacity, { 0, NO_TOPIC_HANDLER });
+
+    shift = 32;
+    for (size_t size = capacity; size > 1; size >>= 1) shift--;
+
+    routeCount = 0;
+    for (auto& route : previous) {
+        if (route.handlerId != NO_TOPIC_HANDLER) {
+            Subscribe(route.topic, route.handlerId);
+        }
+    }
+}
+
+inline DWORD TopicRouter::AddHandler(Handler handler) {
+    handlers.push_back(move(handler));
+    return static_cast<DWORD>(handlers.size() - 1);
+}
+
+inline void TopicRouter::Subscribe(DWORD topic, DWORD handlerId) {
+    if (handlerId >= handlers.size()) {
+        throw runtime_error("Unknown topic handler: " + to_string(handlerId));
+    }
+    if (2 * (routeCount + 1) > table.size()) {
+        Rehash(table.size() * 2);
+    }
+
+    DWORD mask = Mask();
+    for (DWORD slot = HomeSlot(topic);; slot = (slot + 1) & mask) {
+        TopicRoute& route = table[slot];
+        if (route.handlerId == NO_TOPIC_HANDLER) {
+            route = { topic, handlerId };
+            routeCount++;
+            return;
+        }
+        if (route.topic == topic) {
+            route.handlerId = handlerId;
+            return;
+        }
+    }
+}
+
+// Удаление со сдвигом следующих записей цепочки, без "надгробий"
+inline bool TopicRouter::Unsubscribe(DWORD topic) {
+    DWORD mask = Mask();
+    DWORD hole = HomeSlot(topic);
+
+    while (table[hole].topic != topic || table[hole].handlerId == NO_TOPIC_HANDLER) {
+        if (table[hole].handlerId == NO_TOPIC_HANDLER) return false;
+        hole = (hole + 1) & mask;
+    }
+
+    for (DWORD next = (hole + 1) & mask; table[next].handlerId != NO_TOPIC_HANDLER; next = (next + 1) & mask) {
+        DWORD home = HomeSlot(table[next].topic);
+        // Запись можно перенести в дыру, если дыра лежит на ее пути от домашнего слота
+        bool movable = next > hole ? (home <= hole || home > next) : (home <= hole && home > next);
+        if (movable) {
+            table[hole] = table[next];
+            hole = next;
+        }
+    }
+
+    table[hole].handlerId = NO_TOPIC_HANDLER;
+    routeCount--;
+    return true;
+}
+
+inline void TopicRouter::Clear() {
+    for (auto& route : table) {
+        route.handlerId = NO_TOPIC_HANDLER;
+    }
+    routeCount = 0;
+}
+
+inline void TopicRouter::SetDefaultHandler(DWORD handlerId) {
+    defaultHandler = handlerId;
+}
+
+inline DWORD TopicRouter::FindHandler(DWORD topic) const {
+    DWORD mask = Mask();
+    for (DWORD slot = HomeSlot(topic);; slot = (slot + 1) & mask) {
+        const TopicRoute& route = table[slot];
+        if (route.handlerId == NO_TOPIC_HANDLER) return defaultHandler;
+        if (route.topic == topic) return route.handlerId;
+    }
+}
+
+inline bool TopicRouter::Route(DWORD topic, const string& message) {
+    DWORD handlerId = FindHandler(topic);
+    if (handlerId == NO_TOPIC_HANDLER) {
+        filteredCount++;
+        return false;
+    }
+
+    handlers[handlerId](topic, message);
+    return true;
+}
+
+inline DWORD TopicRouter::RouteBatch(RingBuffer& ring, vector<DelayedRecord>& notDue, DWORD maxRecords,
+    const ReadObserver& observer) {
+    RecordInfo info;
+    DWORD read = 0;
+    ULONGLONG now = GetTickCount64();
+
+    while (read < maxRecords && ring.ReadMessage(record, info)) {
+        if (observer) observer(info);
+        if (info.deliverAt > now) {
+            notDue.push_back({ record, info });
+        }
+        else {
+            Route(info.topic, record);
+        }
+        read++;
+    }
+    return read;
+}
+
+inline DWORD TopicRouter::GetSubscriptionCount() const {
+    return routeCount;
+}
+
+inline bool TopicRouter::HasDefaultHandler() const {
+    return defaultHandler != NO_TOPIC_HANDLER;
+}
+
+inline ULONG64 TopicRouter::GetFilteredCount() const {
+    return filteredCount;
+}
@@ -0,0 +1,203 @@
+﻿#pragma once
+#include "common.h"
+#include <fstream>
+#include <iomanip>
+
+// Трассировка фаз обработки сообщения. Без LAB4_TRACING все макросы пустые;
+// со включенной сборкой выключенная в рантайме трассировка стоит одну проверку флага.
+//
+// Этапы жизни сообщения (enqueue, publish, dequeue, deliver) дополнительно пишутся
+// событиями TraceLogging провайдера Lab4.MessagePassing - их можно снять без
+// перезапуска процесса, например: wpr / tracelog -guid, xperf -on Lab4.MessagePassing.
+#ifdef LAB4_TRACING
+#include <TraceLoggingProvider.h>
+
+TRACELOGGING_DECLARE_PROVIDER(g_lab4TraceProvider);
+
+// Регистрация на время жизни процесса; незарегистрированный провайдер ничего не пишет
+struct TraceProviderRegistration {
+    TraceProviderRegistration() {
+        TraceLoggingRegister(g_lab4TraceProvider);
+    }
+
+    ~TraceProviderRegistration() {
+        TraceLoggingUnregister(g_lab4TraceProvider);
+    }
+};
+
+// Ровно один раз на исполняемый файл - в единице трансляции с main
+// {6b0a5f4e-3c1d-4e7a-9a55-2f1c8d7b4e90}
+#define LAB4_DEFINE_TRACE_PROVIDER() \
+    TRACELOGGING_DEFINE_PROVIDER(g_lab4TraceProvider, "Lab4.MessagePassing", \
+        (0x6b0a5f4e, 0x3c1d, 0x4e7a, 0x9a, 0x55, 0x2f, 0x1c, 0x8d, 0x7b, 0x4e, 0x90)); \
+    static TraceProviderRegistration lab4TraceProviderRegistration
+#else
+#define LAB4_DEFINE_TRACE_PROVIDER() static_assert(true, "")
+#endif
+
+const DWORD TRACE_CAPACITY = 1 << 16;
+
+struct TraceEvent {
+    volatile LONG64 sequence;   // индекс записи + 1; 0 или чужой индекс - событие перезаписывается
+    const char* name;
+    LONG64 startTicks;
+    LONG64 endTicks;
+    ULONG64 argument;
+    DWORD threadId;
+};
+
+// Кольцевой буфер событий процесса: запись без блокировок, старые события вытесняются
+class TraceBuffer {
+private:
+    TraceEvent events[TRACE_CAPACITY];
+    alignas(CACHE_LINE_SIZE) volatile LONG64 nextIndex;
+    volatile LONG enabled;
+    LONGLONG ticksPerSecond;
+
+public:
+    TraceBuffer() : events(), nextIndex(0), enabled(0) {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        ticksPerSecond = frequency.QuadPart;
+    }
+
+    static LONG64 Now() {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return now.QuadPart;
+    }
+
+    bool IsEnabled() const {
+        return enabled != 0;
+    }
+
+    void SetEnabled(bool value) {
+        InterlockedExchange(&enabled, value ? 1 : 0);
+    }
+
+    void Clear() {
+        InterlockedExchange64(&nextIndex, 0);
+        for (DWORD i = 0; i < TRACE_CAPACITY; i++) {
+            events[i].sequence = 0;
+        }
+    }
+
+    void Record(const char* name, LONG64 startTicks, LONG64 endTicks, ULONG64 argument) {
+        LONG64 index = InterlockedIncrement64(&nextIndex) - 1;
+        TraceEvent& event = events[index & (TRACE_CAPACITY - 1)];
+
+        event.sequence = 0;
+        MemoryBarrier();
+        event.name = name;
+        event.startTicks = startTicks;
+        event.endTicks = endTicks;
+        event.argument = argument;
+        event.threadId = GetCurrentThreadId();
+        WriteRelease64(&event.sequence, index + 1);
+    }
+
+    // Тики QPC в наносекунды без потери точности на больших значениях счетчика
+    LONG64 TicksToNanoseconds(LONG64 ticks) const {
+        return (ticks / ticksPerSecond) * 1000000000LL + (ticks % ticksPerSecond) * 1000000000LL / ticksPerSecond;
+    }
+
+    LONG64 GetRecordedCount() const {
+        return min<LONG64>(ReadAcquire64(&nextIndex), TRACE_CAPACITY);
+    }
+
+    // Формат Chrome trace-event (chrome://tracing, Perfetto): события "X" с длительностью
+    bool DumpChromeJson(const string& path) const {
+        ofstream out(path);
+        if (!out) return false;
+
+        LONG64 last = ReadAcquire64(&nextIndex);
+        LONG64 first = max<LONG64>(0, last - TRACE_CAPACITY);
+        DWORD processId = GetCurrentProcessId();
+        bool separator = false;
+
+        out << fixed << setprecision(3) << "{\"traceEvents\":[";
+        for (LONG64 index = first; index < last; index++) {
+            const TraceEvent& event = events[index & (TRACE_CAPACITY - 1)];
+            if (ReadAcquire64(&event.sequence) != index + 1) continue;
+
+            out << (separator ? ",\n" : "\n")
+                << "{\"name\":\"" << event.name << "\",\"ph\":\"X\""
+                << ",\"ts\":" << (TicksToNanoseconds(event.startTicks) / 1000.0)
+                << ",\"dur\":" << (TicksToNanoseconds(event.endTicks - event.startTicks) / 1000.0)
+                << ",\"pid\":" << processId << ",\"tid\":" << event.threadId
+                << ",\"args\":{\"id\":" << event.argument << "}}";
+            separator = true;
+        }
+        out << "\n],\"displayTimeUnit\":\"ns\"}" << endl;
+
+        return out.good();
+    }
+};
+
+inline TraceBuffer& GetTraceBuffer() {
+    static TraceBuffer* buffer = new TraceBuffer();
+    return *buffer;
+}
+
+// Замеряет время от создания до конца области видимости
+class TraceScope {
+private:
+    const char* name;
+    ULONG64 argument;
+    LONG64 startTicks;
+    bool active;
+
+public:
+    TraceScope(const char* phaseName, ULONG64 arg)
+        : name(phaseName), argument(arg), startTicks(0), active(GetTraceBuffer().IsEnabled()) {
+        if (active) startTicks = TraceBuffer::Now();
+    }
+
+    ~TraceScope() {
+        if (active) GetTraceBuffer().Record(name, startTicks, TraceBuffer::Now(), argument);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#define LAB4_TRACE_CONCAT_IMPL(a, b) a##b
+#define LAB4_TRACE_CONCAT(a, b) LAB4_TRACE_CONCAT_IMPL(a, b)
+
+// phase - идентификатор фазы, попадает в JSON как имя события.
+// TRACE_LIFECYCLE - мгновенное событие ETW с тем же соглашением об имени; arg - поле "id"
+#ifdef LAB4_TRACING
+#define TRACE_SCOPE(phase, arg) \
+    TraceScope LAB4_TRACE_CONCAT(traceScope_, __LINE__)(#phase, static_cast<ULONG64>(arg))
+#define TRACE_LIFECYCLE(phase, arg) \
+    TraceLoggingWrite(g_lab4TraceProvider, #phase, TraceLoggingUInt64(static_cast<ULONG64>(arg), "id"))
+#define TRACE_ENABLED 1
+#else
+#define TRACE_SCOPE(phase, arg) ((void)0)
+#define TRACE_LIFECYCLE(phase, arg) ((void)0)
+#define TRACE_ENABLED 0
+#endif
+
+// Команда "trace" в консоли Sender/Receiver: первый вызов включает запись, второй сохраняет JSON
+inline void ToggleTracing(const string& dumpPath) {
+    if (!TRACE_ENABLED) {
+        cout << "Tracing is not compiled in (configure with -DLAB4_ENABLE_TRACING=ON)" << endl;
+        return;
+    }
+
+    TraceBuffer& buffer = GetTraceBuffer();
+    if (!buffer.IsEnabled()) {
+        buffer.Clear();
+        buffer.SetEnabled(true);
+        cout << "Tracing started" << endl;
+        return;
+    }
+
+    buffer.SetEnabled(false);
+    if (buffer.DumpChromeJson(dumpPath)) {
+        cout << "Trace with " << buffer.GetRecordedCount() << " events saved to " << dumpPath << endl;
+    }
+    else {
+        cout << "Cannot write trace file: " << dumpPath << endl;
+    }
+}
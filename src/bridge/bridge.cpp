@@ -0,0 +1,223 @@
+﻿#include "../../include/common.h"
+#include "../../include/ringbuff.h"
+#include "../../include/channels.h"
+#include "../../include/bridge.h"
+
+// Мост очереди через сокет для потребителей, которым недоступно отображение файла:
+//   bridge.exe out <очередь> <порт> - вычитывает локальную очередь и отправляет в сокет
+//   bridge.exe in  <очередь> <порт> - принимает соединение и пишет в удаленную очередь
+class Bridge {
+private:
+    unique_ptr<ChannelSegment> segment;
+    unique_ptr<RingBuffer> ringBuffer;
+    unique_ptr<SyncManager> syncManager;
+
+    HANDLE hMessageEvent;
+    vector<HANDLE> creditEvents;
+
+public:
+    Bridge(const string& fileName)
+        : hMessageEvent(NULL) {
+
+        // Очередь создает Receiver своей стороны, мост к ней только подключается
+        string segmentName, channelName;
+        if (SplitChannelAddress(fileName, segmentName, channelName)) {
+            segment = make_unique<ChannelSegment>(segmentName, 0);
+            ringBuffer = segment->OpenChannel(channelName);
+            if (!ringBuffer) {
+                throw runtime_error("Channel not found: " + channelName);
+            }
+        }
+        else {
+            ringBuffer = make_unique<RingBuffer>(fileName, 0, 0);
+        }
+        syncManager = make_unique<SyncManager>(fileName);
+
+        hMessageEvent = syncManager->OpenMessageEvent();
+        if (!hMessageEvent) {
+            throw runtime_error("Failed to open synchronization objects");
+        }
+
+        for (DWORD i = 0; i < ringBuffer->GetCreditSenders(); i++) {
+            HANDLE hCreditEvent = syncManager->OpenCreditEvent(i);
+            if (!hCreditEvent) {
+                throw runtime_error("Failed to open credit event of sender " + to_string(i));
+            }
+            creditEvents.push_back(hCreditEvent);
+        }
+    }
+
+    ~Bridge() {
+        SyncManager::SafeCloseHandle(hMessageEvent);
+        for (auto hEvent : creditEvents) {
+            SyncManager::SafeCloseHandle(hEvent);
+        }
+    }
+
+    // Выход: для Sender'ов своей стороны мост - это Receiver. Кредиты возвращает само
+    // чтение кольца; кому выдана порция, мост не отслеживает и будит всех Sender'ов.
+    // Обрыв с неотправленной пачкой не завершает мост: пачка уже вычитана из кольца,
+    // и она уйдет, когда вход моста снова начнет принимать соединения.
+    void RunOutbound(const string& host, USHORT port, DWORD batchSize) {
+        SOCKET connection = ConnectBridge(host, port);
+        BridgeOutbound outbound(*ringBuffer, connection, batchSize);
+        cout << "Forwarding queue to " << host << ":" << port << " (batch " << batchSize << ")" << endl;
+
+        while (true) {
+            DWORD forwarded;
+            while (outbound.Pump(forwarded)) {
+                if (forwarded > 0) {
+                    for (auto hEvent : creditEvents) {
+                        SetEvent(hEvent);
+                    }
+                }
+                else if (outbound.GetCredits() > 0) {
+                    WaitForSingleObject(hMessageEvent, BRIDGE_CREDIT_WAIT);
+                    ResetMessageEventIfEmpty();
+                }
+            }
+            // Вычитанные записи вернули кредиты, даже если пачка не ушла
+            if (forwarded > 0) {
+                for (auto hEvent : creditEvents) {
+                    SetEvent(hEvent);
+                }
+            }
+
+            closesocket(connection);
+            if (outbound.GetPendingCount() == 0) break;
+
+            cout << "Connection lost with " << outbound.GetPendingCount()
+                << " records unsent, reconnecting..." << endl;
+            connection = ReconnectBridge(host, port);
+            outbound.Reconnect(connection);
+        }
+
+        ShowStats("forwarded", outbound.GetStats());
+    }
+
+    // Вход: для Receiver'а своей стороны мост - это Sender. В кольцо с кредитами он
+    // пишет из своей доли: Receiver резервирует ее для входов моста после Sender'ов
+    void RunInbound(const string& host, USHORT port, DWORD credits, DWORD creditId) {
+        if (ringBuffer->GetCreditSenders() > 0 && !ringBuffer->AttachCredits(creditId)) {
+            throw runtime_error("Queue is credited: pass a credit entry reserved for the bridge (--credit-id, 0.."
+                + to_string(ringBuffer->GetCreditSenders() - 1) + ")");
+        }
+
+        SOCKET listener = ListenBridge(host, port);
+        cout << "Waiting for bridge connection on " << host << ":" << port << "..." << endl;
+        SOCKET connection = AcceptBridge(listener);
+        closesocket(listener);
+
+        BridgeInbound inbound(*ringBuffer, connection, credits);
+        cout << "Bridge connected (credit window " << credits << ")" << endl;
+
+        DWORD delivered;
+        while (inbound.Pump(delivered)) {
+            if (delivered > 0) {
+                SetEvent(hMessageEvent);
+            }
+        }
+        // Часть кадра могла лечь в кольцо до обрыва или истечения срока
+        if (delivered > 0) {
+            SetEvent(hMessageEvent);
+        }
+
+        closesocket(connection);
+        ShowStats("delivered", inbound.GetStats());
+    }
+
+private:
+    static SOCKET ReconnectBridge(const string& host, USHORT port) {
+        while (true) {
+            Sleep(BRIDGE_RECONNECT_INTERVAL);
+            try {
+                return ConnectBridge(host, port);
+            }
+            catch (const runtime_error&) {
+            }
+        }
+    }
+
+    // Sender мог записать сообщение между проверкой и сбросом события
+    void ResetMessageEventIfEmpty() {
+        if (ringBuffer->IsEmpty()) {
+            ResetEvent(hMessageEvent);
+            if (!ringBuffer->IsEmpty()) {
+                SetEvent(hMessageEvent);
+            }
+        }
+    }
+
+    static void ShowStats(const char* action, const BridgeStats& stats) {
+        cout << "Connection closed: " << stats.records << " records " << action
+            << " in " << stats.batches << " batches";
+        if (stats.creditWaits > 0) {
+            cout << ", waited for credits " << stats.creditWaits << " times";
+        }
+        cout << endl;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        cout << "Usage: bridge.exe out <filename | segment@channel> <port> [--host <addr>] [--batch <n>]" << endl;
+        cout << "       bridge.exe in  <filename | segment@channel> <port> [--host <addr>] [--credits <n>]"
+            " [--credit-id <n>]" << endl;
+        return 1;
+    }
+
+    string mode = argv[1];
+    string fileName = argv[2];
+    string host = "127.0.0.1";
+    USHORT port;
+    DWORD batchSize = DEFAULT_BRIDGE_BATCH;
+    DWORD credits = DEFAULT_BRIDGE_CREDITS;
+    DWORD creditId = NO_CREDIT_SOURCE;
+    try {
+        port = static_cast<USHORT>(stoul(argv[3]));
+        for (int i = 4; i + 1 < argc; i += 2) {
+            string option = argv[i];
+            if (option == "--host") {
+                host = argv[i + 1];
+            }
+            else if (option == "--batch") {
+                batchSize = stoul(argv[i + 1]);
+            }
+            else if (option == "--credits") {
+                credits = stoul(argv[i + 1]);
+            }
+            else if (option == "--credit-id") {
+                creditId = stoul(argv[i + 1]);
+            }
+            else {
+                throw invalid_argument(option);
+            }
+        }
+    }
+    catch (const exception&) {
+        cout << "Invalid bridge arguments!" << endl;
+        return 1;
+    }
+
+    try {
+        WinsockSession winsock;
+        Bridge bridge(fileName);
+
+        if (mode == "out") {
+            bridge.RunOutbound(host, port, batchSize);
+        }
+        else if (mode == "in") {
+            bridge.RunInbound(host, port, credits, creditId);
+        }
+        else {
+            cout << "Unknown mode: " << mode << endl;
+            return 1;
+        }
+    }
+    catch (const exception& e) {
+        cout << "Error: " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,39 +1,90 @@
 ﻿#include "../../include/common.h"
 #include "../../include/ringbuff.h"
+#include "../../include/channels.h"
+#include "../../include/trace.h"
+#include "../../include/placement.h"
+#include "../../include/timingwheel.h"
+#include "../../include/topics.h"
+#include "../../include/perfcounters.h"
+#include <sstream>
 #include <vector>
 #include <thread>
 #include <chrono>
 
+LAB4_DEFINE_TRACE_PROVIDER();
+
+const DWORD RECEIVE_TIMEOUT = 5000;
+const DWORD TIMER_POLL_INTERVAL = 10;
+
 class Receiver {
 private:
+    unique_ptr<ChannelSegment> segment;
     unique_ptr<RingBuffer> ringBuffer;
     unique_ptr<SyncManager> syncManager;
     vector<HANDLE> senderProcesses;
     vector<HANDLE> readyEvents;
+    vector<HANDLE> creditEvents;
 
     HANDLE hFileMutex;
     HANDLE hMessageEvent;
-    HANDLE hSpaceEvent;
-    HANDLE hQueueSemaphore;
     DWORD totalRecords;
+    LONG64 nextSequence;
+    PlacementPlan placement;
+    TimingWheel timers;
+    vector<DueMessage> dueMessages;
+    size_t nextDue;
+    TopicRouter router;
+    DWORD printHandler;
+    unique_ptr<PerfCounters> perfCounters;
 
 public:
-    Receiver(const string& fileName, DWORD recordCount)
-        : hFileMutex(NULL), hMessageEvent(NULL), hSpaceEvent(NULL),
-        hQueueSemaphore(NULL), totalRecords(recordCount) {
-
-        // Пункт 1: Создать бинарный файл для сообщений
-        ringBuffer = make_unique<RingBuffer>(fileName, recordCount);
+    Receiver(const string& fileName, DWORD recordCount, OverflowPolicy policy = OVERFLOW_BLOCK,
+        const PlacementPlan& plan = PlacementPlan(), bool checksums = false, DWORD creditSenders = 0)
+        : hFileMutex(NULL), hMessageEvent(NULL), totalRecords(recordCount), nextSequence(0), placement(plan),
+        nextDue(0) {
+
+        // По умолчанию принимаются все темы; команда subscribe оставляет только выбранные
+        printHandler = router.AddHandler([](DWORD topic, const string& message) {
+            cout << ">>> Received [topic " << topic << "]: " << message << endl;
+            });
+        router.SetDefaultHandler(printHandler);
+
+        // Кольцо размещается на NUMA-узле ядра Receiver'а: индексы обновляются чаще всего
+        // потребителем, и они не должны ходить через межсоединение. Без ядра в плане
+        // Receiver мигрирует, и узел не выбирается (NUMA_NO_PREFERRED_NODE)
+        if (!PinCurrentThread(placement.receiverCore)) {
+            throw runtime_error("Cannot pin receiver to core " + to_string(placement.receiverCore));
+        }
+        DWORD numaNode = GetCoreNumaNode(placement.receiverCore);
+
+        // Пункт 1: Создать бинарный файл для сообщений (или канал в общем сегменте)
+        string segmentName, channelName;
+        if (SplitChannelAddress(fileName, segmentName, channelName)) {
+            segment = make_unique<ChannelSegment>(segmentName, DEFAULT_SEGMENT_SIZE, DEFAULT_CHANNEL_DIRECTORY, numaNode);
+            ringBuffer = segment->CreateChannel(channelName, recordCount, MAX_MESSAGE_SIZE, policy, creditSenders);
+            // Сегмент переживает Receiver: канал прошлого запуска мог остаться с сообщениями и кредитами
+            ringBuffer->Reset();
+        }
+        else {
+            ringBuffer = make_unique<RingBuffer>(fileName, recordCount, MAX_MESSAGE_SIZE, policy, numaNode, creditSenders);
+        }
+        ringBuffer->SetChecksums(checksums);
         syncManager = make_unique<SyncManager>(fileName);
 
         hFileMutex = syncManager->CreateFileMutex();
         hMessageEvent = syncManager->CreateMessageEvent();
-        hSpaceEvent = syncManager->CreateSpaceEvent();
-        hQueueSemaphore = syncManager->CreateQueueSemaphore(static_cast<LONG>(recordCount), static_cast<LONG>(recordCount));
 
-        if (!hFileMutex || !hMessageEvent || !hSpaceEvent || !hQueueSemaphore) {
+        if (!hFileMutex || !hMessageEvent) {
             throw runtime_error("Failed to create synchronization objects");
         }
+
+        for (DWORD i = 0; i < creditSenders; i++) {
+            HANDLE hCreditEvent = syncManager->CreateCreditEvent(i);
+            if (!hCreditEvent) {
+                throw runtime_error("Failed to create credit event for Sender " + to_string(i));
+            }
+            creditEvents.push_back(hCreditEvent);
+        }
     }
 
     ~Receiver() {
@@ -51,6 +102,10 @@ public:
             ZeroMemory(&pi, sizeof(pi));
 
             string commandLine = "sender.exe " + fileName + " " + to_string(i);
+            int core = placement.GetSenderCore(i);
+            if (core != NO_CORE) {
+                commandLine += " --core " + to_string(core);
+            }
 
             if (!CreateProcessA(NULL,
                 const_cast<LPSTR>(commandLine.c_str()),
@@ -107,16 +162,28 @@ public:
 
         while (true) {
             cout << "\n=== RECEIVER ===" << endl;
-            cout << "Commands: read, status, exit" << endl;
+            cout << "Commands: read, drain, subscribe, status, trace, perf, exit" << endl;
             cout << "Enter command: ";
             getline(cin, command);
 
             if (command == "read") {
                 ReadMessage();
             }
+            else if (command == "drain") {
+                DrainMessages();
+            }
+            else if (command == "subscribe") {
+                Subscribe();
+            }
             else if (command == "status") {
                 ShowStatus();
             }
+            else if (command == "trace") {
+                ToggleTracing("receiver_trace.json");
+            }
+            else if (command == "perf") {
+                TogglePerf();
+            }
             else if (command == "exit") {
                 break;
             }
@@ -128,46 +195,258 @@ public:
 
 private:
     void ReadMessage() {
-        // Читать сообщение из бинарного файла
-        DWORD waitResult = WaitForSingleObject(hMessageEvent, 5000);
+        // Читать сообщение из бинарного файла. Отложенные записи ждут срока в колесе
+        // таймеров и выдаются раньше новых записей кольца, как только срок наступил.
+        ULONGLONG deadline = GetTickCount64() + RECEIVE_TIMEOUT;
 
-        if (waitResult == WAIT_OBJECT_0) {
-            WaitForSingleObject(hFileMutex, INFINITE);
+        while (true) {
+            if (ReleaseDueMessages()) {
+                DueMessage& due = dueMessages[nextDue++];
+                if (router.Route(due.topic, due.message)) return;
+                continue;
+            }
 
-            string message;
-            if (ringBuffer->ReadMessage(message)) {
-                cout << ">>> Received: " << message << endl;
+            DWORD waitResult = WaitForMessage(deadline);
 
-                if (ringBuffer->IsEmpty()) {
-                    ResetEvent(hMessageEvent);
+            if (waitResult == WAIT_OBJECT_0) {
+                string message;
+                RecordInfo info;
+                bool received = CopyFromQueue(message, info);
+                if (received && info.creditGranted) {
+                    SignalCredit(info.source);
                 }
-                SetEvent(hSpaceEvent);
+                ResetMessageEventIfEmpty();
 
-                ReleaseSemaphore(hQueueSemaphore, 1, NULL);
+                if (!received) {
+                    if (timers.GetPendingCount() > 0) continue;
+                    cout << "No message available!" << endl;
+                }
+                else if (info.deliverAt > GetTickCount64()) {
+                    ScheduleMessage(message, info);
+                    continue;
+                }
+                else if (!ConsumeMessage(message, info)) {
+                    // Тема без подписки: сообщение отброшено, ждем следующее
+                    continue;
+                }
+            }
+            else if (waitResult == WAIT_TIMEOUT) {
+                // Короткие ожидания нужны, пока в колесе есть таймеры
+                if (GetTickCount64() < deadline) continue;
+                cout << "No messages received within timeout" << endl;
             }
             else {
-                cout << "No message available!" << endl;
-                ResetEvent(hMessageEvent);
+                cout << "Error waiting for message: " << waitResult << endl;
             }
+            return;
+        }
+    }
 
-            ReleaseMutex(hFileMutex);
+    // Все, что уже есть в кольце и в наступивших таймерах, раздается пачками: кольцо
+    // вычитывается через RouteBatch, отложенные записи уходят в колесо таймеров
+    void DrainMessages() {
+        PerfSample perfStart = perfCounters ? perfCounters->Read() : PerfSample();
+        ULONG64 filteredBefore = router.GetFilteredCount();
+        DWORD released = 0;
+        while (ReleaseDueMessages()) {
+            DueMessage& due = dueMessages[nextDue++];
+            router.Route(due.topic, due.message);
+            released++;
         }
-        else if (waitResult == WAIT_TIMEOUT) {
-            cout << "No messages received within timeout" << endl;
+
+        vector<DelayedRecord> notDue;
+        DWORD read = 0;
+        DWORD batch;
+        while ((batch = CopyBatchFromQueue(notDue)) > 0) {
+            read += batch;
+        }
+        ResetMessageEventIfEmpty();
+
+        for (auto& delayed : notDue) {
+            ScheduleTimer(delayed.message, delayed.info);
+        }
+
+        ULONG64 filtered = router.GetFilteredCount() - filteredBefore;
+        cout << "Drained " << read << " record(s) from the queue and " << released << " due timer(s): "
+            << (read + released - notDue.size() - filtered) << " delivered, " << notDue.size()
+            << " scheduled, " << filtered << " without subscription" << endl;
+        if (perfCounters) {
+            cout << "Receive path: " << perfCounters->DescribePerMessage(perfStart, perfCounters->Read(),
+                read + released) << endl;
+        }
+    }
+
+    // Счетчики считают поток команд; снимок переключений контекста дорогой, поэтому
+    // замеряется вся команда drain целиком, а не каждое сообщение
+    void TogglePerf() {
+        if (perfCounters) {
+            perfCounters.reset();
+            cout << "Receive path counters: off" << endl;
+            return;
+        }
+        perfCounters = make_unique<PerfCounters>();
+        cout << "Receive path counters: on, reported after each drain ("
+            << PerfCounters::Name(PERF_CONTEXT_SWITCHES) << " "
+            << (perfCounters->IsAvailable(PERF_CONTEXT_SWITCHES) ? "available" : "n/a") << ")" << endl;
+    }
+
+    // Фазы чтения вынесены отдельно, чтобы трассировка замеряла каждую из них
+    DWORD WaitForMessage(ULONGLONG deadline) {
+        TRACE_SCOPE(receive_wait_message, 0);
+        DWORD timeout = RemainingTime(deadline);
+        if (timers.GetPendingCount() > 0) {
+            timeout = min(timeout, TIMER_POLL_INTERVAL);
+        }
+        return WaitForSingleObject(hMessageEvent, timeout);
+    }
+
+    bool CopyFromQueue(string& message, RecordInfo& info) {
+        TRACE_SCOPE(receive_copy, nextSequence);
+        if (!ringBuffer->ReadMessage(message, info)) return false;
+
+        TRACE_LIFECYCLE(dequeue, info.sequence);
+        return true;
+    }
+
+    // Пачка раздается обработчикам внутри RouteBatch; sequence и кредиты разбирает наблюдатель
+    DWORD CopyBatchFromQueue(vector<DelayedRecord>& notDue) {
+        TRACE_SCOPE(receive_copy_batch, nextSequence);
+        return router.RouteBatch(*ringBuffer, notDue, DEFAULT_ROUTE_BATCH, [this](const RecordInfo& info) {
+            TRACE_LIFECYCLE(dequeue, info.sequence);
+            CheckSequence(info.sequence);
+            if (info.creditGranted) {
+                SignalCredit(info.source);
+            }
+            });
+    }
+
+    // Sender мог записать сообщение между чтением и сбросом события
+    void ResetMessageEventIfEmpty() {
+        if (ringBuffer->IsEmpty()) {
+            ResetEvent(hMessageEvent);
+            if (!ringBuffer->IsEmpty()) {
+                SetEvent(hMessageEvent);
+            }
+        }
+    }
+
+    // Слот кольца освобождается сразу, запись ждет срока в колесе таймеров
+    void ScheduleMessage(const string& message, const RecordInfo& info) {
+        TRACE_SCOPE(receive_schedule, info.sequence);
+        CheckSequence(info.sequence);
+        ScheduleTimer(message, info);
+    }
+
+    void ScheduleTimer(const string& message, const RecordInfo& info) {
+        if (!timers.Schedule(info.deliverAt, message, info.topic)) {
+            cout << "!!! Timer pool is full, delivering delayed message early" << endl;
+            router.Route(info.topic, message);
+        }
+    }
+
+    // Наступившие таймеры выдаются пачкой за одно продвижение колеса
+    bool ReleaseDueMessages() {
+        if (nextDue < dueMessages.size()) return true;
+
+        dueMessages.clear();
+        nextDue = 0;
+        if (timers.GetPendingCount() == 0) return false;
+
+        TRACE_SCOPE(receive_release_timers, timers.GetPendingCount());
+        return timers.Advance(GetTickCount64(), dueMessages) > 0;
+    }
+
+    // Кредит вернулся при чтении записи; будим Sender'а, только когда ему выдана новая порция
+    void SignalCredit(DWORD source) {
+        TRACE_SCOPE(receive_signal, source);
+        if (source < creditEvents.size()) {
+            SetEvent(creditEvents[source]);
+        }
+    }
+
+    // Тема берется из заголовка записи; false - на тему никто не подписан
+    bool ConsumeMessage(const string& message, const RecordInfo& info) {
+        TRACE_SCOPE(receive_consume, info.sequence);
+        TRACE_LIFECYCLE(deliver, info.sequence);
+        CheckSequence(info.sequence);
+
+        return router.Route(info.topic, message);
+    }
+
+    void Subscribe() {
+        cout << "Enter topics to receive (space-separated, empty - all): ";
+        string line;
+        getline(cin, line);
+
+        istringstream in(line);
+        vector<DWORD> topics;
+        DWORD topic;
+        while (in >> topic) {
+            topics.push_back(topic);
+        }
+        if (!in.eof()) {
+            cout << "Invalid topic list!" << endl;
+            return;
+        }
+
+        router.Clear();
+        for (DWORD subscribed : topics) {
+            router.Subscribe(subscribed, printHandler);
+        }
+        router.SetDefaultHandler(topics.empty() ? printHandler : NO_TOPIC_HANDLER);
+
+        if (topics.empty()) {
+            cout << "Receiving all topics" << endl;
         }
         else {
-            cout << "Error waiting for message: " << waitResult << endl;
+            cout << "Receiving " << router.GetSubscriptionCount() << " topic(s)" << endl;
+        }
+    }
+
+    // Разрыв в номерах означает, что записи были вытеснены Sender'ом или повреждены
+    void CheckSequence(LONG64 sequence) {
+        if (sequence > nextSequence) {
+            cout << "!!! Skipped " << (sequence - nextSequence)
+                << " overwritten or corrupt message(s)" << endl;
         }
+        nextSequence = sequence + 1;
+    }
+
+    static DWORD RemainingTime(ULONGLONG deadline) {
+        ULONGLONG now = GetTickCount64();
+        return now >= deadline ? 0 : static_cast<DWORD>(deadline - now);
     }
 
     void ShowStatus() {
-        WaitForSingleObject(hFileMutex, INFINITE);
         DWORD messageCount = ringBuffer->GetMessageCount();
         DWORD freeSlots = totalRecords - messageCount;
         cout << "Queue status: " << messageCount
             << " messages, " << freeSlots
             << " free slots" << endl;
-        ReleaseMutex(hFileMutex);
+        cout << "Overflow policy: " << OverflowPolicyName(ringBuffer->GetOverflowPolicy())
+            << ", dropped: " << ringBuffer->GetDroppedCount()
+            << ", overwritten: " << ringBuffer->GetOverwrittenCount() << endl;
+        cout << "Checksums: " << (ringBuffer->IsChecksumEnabled() ? "on" : "off")
+            << " (" << (HasCrc32cHardware() ? "hardware" : "software") << " CRC32C)"
+            << ", corrupt records skipped: " << ringBuffer->GetCorruptCount() << endl;
+        cout << "Subscriptions: " << (router.HasDefaultHandler() ? string("all topics")
+            : to_string(router.GetSubscriptionCount()) + " topic(s)")
+            << ", filtered: " << router.GetFilteredCount() << endl;
+        if (ringBuffer->GetCreditSenders() > 0) {
+            CreditUsage usage;
+            for (DWORD i = 0; ringBuffer->GetCreditUsage(i, usage); i++) {
+                cout << "Credits of sender " << i << ": " << usage.inFlight << " in flight, "
+                    << usage.available << " available of window " << usage.window
+                    << ", sent: " << usage.used << ", waited: " << usage.waits << " time(s)" << endl;
+            }
+        }
+        cout << "Delayed messages: " << timers.GetPendingCount() + (dueMessages.size() - nextDue)
+            << " pending, timer pool " << timers.GetCapacity() << endl;
+        cout << "Placement: receiver " << DescribePlacement(placement.receiverCore)
+            << ", queue memory node " << DescribeNumaNode(ringBuffer->GetNumaNode()) << endl;
+        for (auto& sender : placement.senderCores) {
+            cout << "           sender " << sender.first << " core " << sender.second << endl;
+        }
     }
 
     void Cleanup() {
@@ -182,21 +461,26 @@ private:
             SyncManager::SafeCloseHandle(hEvent);
         }
 
+        for (auto hEvent : creditEvents) {
+            SyncManager::SafeCloseHandle(hEvent);
+        }
+
         SyncManager::SafeCloseHandle(hFileMutex);
         SyncManager::SafeCloseHandle(hMessageEvent);
-        SyncManager::SafeCloseHandle(hSpaceEvent);
-        SyncManager::SafeCloseHandle(hQueueSemaphore);
     }
 };
 
 int main() {
-    string fileName;
+    string fileName, policyName, placementSpec, checksumAnswer;
     DWORD recordCount, senderCount;
+    DWORD bridgeCount = 0;
+    OverflowPolicy policy;
+    PlacementPlan placement;
 
     cout << "=== MESSAGE RECEIVER ===" << endl;
 
     // Пункт 1: Ввести с консоли имя файла и количество записей
-    cout << "Enter binary file name: ";
+    cout << "Enter binary file name (or <segment>@<channel>): ";
     getline(cin, fileName);
 
     cout << "Enter number of records in queue: ";
@@ -207,8 +491,46 @@ int main() {
     cin >> senderCount;
     cin.ignore();
 
+    cout << "Enter overflow policy (block, overwrite, drop, spill) [block]: ";
+    getline(cin, policyName);
+    if (!ParseOverflowPolicy(policyName, policy)) {
+        cout << "Unknown overflow policy!" << endl;
+        return 1;
+    }
+
+    // Вход моста пишет в кольцо как еще один Sender, и в режиме block ему нужна своя доля
+    if (policy == OVERFLOW_BLOCK) {
+        string bridgeAnswer;
+        cout << "Enter number of bridge inputs writing to this queue [0]: ";
+        getline(cin, bridgeAnswer);
+        try {
+            bridgeCount = bridgeAnswer.empty() ? 0 : stoul(bridgeAnswer);
+        }
+        catch (const exception&) {
+            cout << "Invalid number of bridge inputs!" << endl;
+            return 1;
+        }
+    }
+
+    cout << "Enter CPU placement (e.g. r:0 s0:2 s1:4) [none]: ";
+    getline(cin, placementSpec);
+    if (!ParsePlacementPlan(placementSpec, placement)) {
+        cout << "Invalid placement!" << endl;
+        return 1;
+    }
+
+    cout << "Enable per-record checksums (y/n) [n]: ";
+    getline(cin, checksumAnswer);
+
     try {
-        Receiver receiver(fileName, recordCount);
+        // В режимах overwrite/drop Sender'ы не ждут, и доли кольца им не нужны.
+        // Доли входов моста идут после долей Sender'ов
+        Receiver receiver(fileName, recordCount, policy, placement, checksumAnswer == "y",
+            policy == OVERFLOW_BLOCK ? senderCount + bridgeCount : 0);
+        for (DWORD i = 0; i < bridgeCount; i++) {
+            cout << "Bridge input " << i << ": bridge.exe in " << fileName << " <port> --credit-id "
+                << senderCount + i << endl;
+        }
 
         if (!receiver.StartSenders(fileName, senderCount)) {
             cout << "Failed to start sender processes!" << endl;
@@ -1,41 +1,80 @@
 ﻿#include "../../include/common.h"
 #include "../../include/ringbuff.h"
+#include "../../include/channels.h"
+#include "../../include/trace.h"
+#include "../../include/placement.h"
+#include "../../include/coalescer.h"
+#include "../../include/spill.h"
+#include "../../include/perfcounters.h"
 #include <thread>
 #include <chrono>
 
+LAB4_DEFINE_TRACE_PROVIDER();
+
 class Sender {
 private:
+    unique_ptr<ChannelSegment> segment;
     unique_ptr<RingBuffer> ringBuffer;
     unique_ptr<SyncManager> syncManager;
+    unique_ptr<SpillQueue> spill;
     DWORD senderId;
+    DWORD topic;
+    DWORD sendTimeout;
+    int core;
+    bool credited;
 
     HANDLE hFileMutex;
     HANDLE hMessageEvent;
-    HANDLE hSpaceEvent;
-    HANDLE hQueueSemaphore;
+    HANDLE hCreditEvent;
     HANDLE hReadyEvent;
 
 public:
-    Sender(const string& fileName, DWORD id)
-        : senderId(id), hFileMutex(NULL), hMessageEvent(NULL),
-        hSpaceEvent(NULL), hQueueSemaphore(NULL), hReadyEvent(NULL) {
+    Sender(const string& fileName, DWORD id, DWORD timeoutMs = DEFAULT_SEND_TIMEOUT, int coreId = NO_CORE)
+        : senderId(id), topic(id), sendTimeout(timeoutMs), core(coreId), credited(false), hFileMutex(NULL),
+        hMessageEvent(NULL), hCreditEvent(NULL), hReadyEvent(NULL) {
+
+        if (!PinCurrentThread(core)) {
+            throw runtime_error("Cannot pin sender to core " + to_string(core));
+        }
 
-        // Пункт 1: Открыть файл для передачи сообщений
-        ringBuffer = make_unique<RingBuffer>(fileName, 0, 0);
+        // Пункт 1: Открыть файл для передачи сообщений (или канал в общем сегменте)
+        string segmentName, channelName;
+        if (SplitChannelAddress(fileName, segmentName, channelName)) {
+            segment = make_unique<ChannelSegment>(segmentName, 0);
+            ringBuffer = segment->OpenChannel(channelName);
+            if (!ringBuffer) {
+                throw runtime_error("Channel not found: " + channelName);
+            }
+        }
+        else {
+            ringBuffer = make_unique<RingBuffer>(fileName, 0, 0);
+        }
         syncManager = make_unique<SyncManager>(fileName);
 
         hFileMutex = syncManager->OpenFileMutex();
         hMessageEvent = syncManager->OpenMessageEvent();
-        hSpaceEvent = syncManager->OpenSpaceEvent();
-        hQueueSemaphore = syncManager->OpenQueueSemaphore();
         hReadyEvent = syncManager->CreateReadyEvent(senderId);
 
-        if (!hFileMutex || !hMessageEvent || !hSpaceEvent || !hQueueSemaphore || !hReadyEvent) {
+        // Кредиты раздает Receiver в режиме block; без них запись ждет места в самом кольце
+        credited = ringBuffer->AttachCredits(senderId);
+        if (credited) {
+            hCreditEvent = syncManager->OpenCreditEvent(senderId);
+        }
+
+        if (!hFileMutex || !hMessageEvent || !hReadyEvent || (credited && !hCreditEvent)) {
             throw runtime_error("Failed to open synchronization objects");
         }
+
+        // Свой файл сброса у каждого Sender'а: порядок гарантируется в пределах одного писателя
+        if (ringBuffer->GetOverflowPolicy() == OVERFLOW_SPILL) {
+            spill = make_unique<SpillQueue>(*ringBuffer, fileName + "_spill_" + to_string(senderId) + ".bin",
+                hMessageEvent);
+        }
     }
 
     ~Sender() {
+        // Поток сброса взводит hMessageEvent: он должен остановиться до закрытия описателей
+        spill.reset();
         Cleanup();
     }
 
@@ -45,23 +84,76 @@ public:
         cout << "Sender " << senderId << " is ready!" << endl;
     }
 
+    // Нагрузочный режим без консоли: сообщения с номерами [first, last) как можно быстрее.
+    // coalesceUs > 0 - мелкие сообщения склеиваются в пачки со сроком сброса coalesceUs;
+    // perf - в конце вывести такты на сообщение и переключения контекста потока отправки
+    void RunSoak(ULONG64 first, ULONG64 last, DWORD coalesceUs = 0, bool perf = false) {
+        SoakRecord record = { senderId, 0, 0 };
+        unique_ptr<PerfCounters> counters;
+        PerfSample perfStart = {};
+        if (perf) {
+            counters = make_unique<PerfCounters>();
+            perfStart = counters->Read();
+        }
+
+        unique_ptr<MessageCoalescer> coalescer;
+        if (coalesceUs > 0) {
+            coalescer = make_unique<MessageCoalescer>(*ringBuffer, coalesceUs, hMessageEvent);
+        }
+
+        for (ULONG64 sequence = first; sequence < last; sequence++) {
+            record.sequence = sequence;
+            string message(reinterpret_cast<const char*>(&record), sizeof(record));
+
+            if (coalescer) {
+                while (!coalescer->Write(0, message, sendTimeout)) {
+                    // Пачку некуда сбросить: ждем Receiver так же, как без склейки
+                }
+                continue;
+            }
+
+            while (!ringBuffer->WriteMessage(message, sendTimeout)) {
+                // Receiver не успевает: продолжаем ждать, порядок важнее задержки
+            }
+            SetEvent(hMessageEvent);
+        }
+
+        while (coalescer && !coalescer->Flush(sendTimeout)) {
+        }
+
+        if (counters) {
+            cout << "Sender " << senderId << " send path: "
+                << counters->DescribePerMessage(perfStart, counters->Read(), last - first) << endl;
+        }
+    }
+
     // Пункт 3: Выполнять циклически действия по команде с консоли
     void ProcessCommands() {
         string command;
 
         while (true) {
             cout << "\n=== SENDER " << senderId << " ===" << endl;
-            cout << "Commands: send, status, exit" << endl;
+            cout << "Commands: send, delay, topic, status, trace, exit" << endl;
             cout << "Enter command: ";
             getline(cin, command);
 
             if (command == "send") {
                 SendMessage();
             }
+            else if (command == "delay") {
+                SendDelayedMessage();
+            }
+            else if (command == "topic") {
+                ChangeTopic();
+            }
             else if (command == "status") {
                 ShowStatus();
             }
+            else if (command == "trace") {
+                ToggleTracing("sender_" + to_string(senderId) + "_trace.json");
+            }
             else if (command == "exit") {
+                DrainSpill();
                 break;
             }
             else {
@@ -71,83 +163,239 @@ public:
     }
 
 private:
-    void SendMessage() {
+    // delayMs > 0 - Receiver выдаст сообщение не раньше, чем через delayMs
+    void SendMessage(DWORD delayMs = 0) {
         // Отправить процессу Receiver сообщение
-        DWORD waitResult = WaitForSingleObject(hSpaceEvent, 5000);
+        if (ringBuffer->GetOverflowPolicy() != OVERFLOW_BLOCK) {
+            SendLossyMessage(delayMs);
+            return;
+        }
 
-        if (waitResult == WAIT_OBJECT_0) {
-            waitResult = WaitForSingleObject(hQueueSemaphore, 5000);
+        ULONGLONG deadline = GetTickCount64() + sendTimeout;
+        DWORD waitResult = WaitForCredit(deadline);
 
-            if (waitResult == WAIT_OBJECT_0) {
-                cout << "Enter message (max " << (MAX_MESSAGE_SIZE - 10) << " chars): ";
-                string message;
-                getline(cin, message);
+        if (waitResult == WAIT_OBJECT_0) {
+            string message = ReadMessageFromConsole();
 
-                string fullMessage = "[Sender " + to_string(senderId) + "] " + message;
+            if (CopyToQueue(message, RemainingTime(deadline), delayMs)) {
+                cout << ">>> Message sent to topic " << topic << ": " << message << endl;
 
-                WaitForSingleObject(hFileMutex, INFINITE);
+                SignalMessage();
+            }
+            else {
+                cout << "Failed to write message - queue full!" << endl;
+            }
+        }
+        else {
+            cout << "No credit available - receiver is behind" << endl;
+        }
+    }
 
-                if (ringBuffer->WriteMessage(fullMessage)) {
-                    cout << ">>> Message sent: " << fullMessage << endl;
+    void SendDelayedMessage() {
+        cout << "Enter delay (ms): ";
+        string delay;
+        getline(cin, delay);
 
-                    SetEvent(hMessageEvent);
+        try {
+            SendMessage(stoul(delay));
+        }
+        catch (const exception&) {
+            cout << "Invalid delay!" << endl;
+        }
+    }
 
-                    if (ringBuffer->IsFull()) {
-                        ResetEvent(hSpaceEvent);
-                    }
-                }
-                else {
-                    cout << "Failed to write message - queue full!" << endl;
-                    ReleaseSemaphore(hQueueSemaphore, 1, NULL);
-                }
+    // Режимы overwrite/drop/spill никогда не блокируют Sender
+    void SendLossyMessage(DWORD delayMs) {
+        string message = ReadMessageFromConsole();
 
-                ReleaseMutex(hFileMutex);
-            }
-            else {
-                cout << "Timeout waiting for queue access" << endl;
+        if (CopyToQueue(message, 0, delayMs)) {
+            cout << ">>> Message sent to topic " << topic << ": " << message;
+            if (spill && spill->IsSpilling()) {
+                cout << " (spilled to disk, " << spill->GetPendingCount() << " pending)";
             }
+            cout << endl;
+            SignalMessage();
         }
         else {
-            cout << "No space available in queue" << endl;
+            cout << "Queue full - message dropped (total dropped: "
+                << ringBuffer->GetDroppedCount() << ")" << endl;
+        }
+    }
+
+    // Фазы отправки вынесены отдельно, чтобы трассировка замеряла каждую из них.
+    // Пока кредит есть, ядро не участвует; ждем только при пустом счете.
+    DWORD WaitForCredit(ULONGLONG deadline) {
+        TRACE_SCOPE(send_wait_credit, senderId);
+        if (!credited) return WAIT_OBJECT_0;
+
+        while (ringBuffer->GetCredits(senderId) <= 0) {
+            ringBuffer->CountCreditWait();
+            // Событие с автосбросом взводится после выдачи порции, проверка до ожидания ее не теряет
+            DWORD waitResult = WaitForSingleObject(hCreditEvent, RemainingTime(deadline));
+            if (waitResult != WAIT_OBJECT_0) return waitResult;
         }
+        return WAIT_OBJECT_0;
+    }
+
+    bool CopyToQueue(const string& message, DWORD timeoutMs, DWORD delayMs) {
+        TRACE_SCOPE(send_copy, senderId);
+        TRACE_LIFECYCLE(enqueue, senderId);
+        if (spill) {
+            spill->Write(topic, message, delayMs);
+            return true;
+        }
+        if (delayMs > 0) {
+            return ringBuffer->WriteDelayedMessage(message, delayMs, timeoutMs, topic);
+        }
+        return ringBuffer->WriteMessageTo(topic, message, timeoutMs);
+    }
+
+    void SignalMessage() {
+        TRACE_SCOPE(send_signal, senderId);
+        TRACE_LIFECYCLE(publish, senderId);
+        SetEvent(hMessageEvent);
+    }
+
+    string ReadMessageFromConsole() {
+        cout << "Enter message (max " << MAX_MESSAGE_SIZE << " chars): ";
+        string message;
+        getline(cin, message);
+
+        // Источник передается темой в заголовке записи, а не префиксом в тексте
+        return message;
+    }
+
+    // По умолчанию тема совпадает с номером Sender'а
+    void ChangeTopic() {
+        cout << "Enter topic [" << topic << "]: ";
+        string value;
+        getline(cin, value);
+        if (value.empty()) return;
+
+        try {
+            topic = stoul(value);
+            cout << "Sending to topic " << topic << endl;
+        }
+        catch (const exception&) {
+            cout << "Invalid topic!" << endl;
+        }
+    }
+
+    // Перед выходом сброшенные сообщения возвращаются в кольцо, иначе остаются в файле
+    void DrainSpill() {
+        if (!spill || !spill->IsSpilling()) return;
+
+        cout << "Waiting for " << spill->GetPendingCount() << " spilled message(s) to reach the queue..." << endl;
+        if (!spill->WaitDrained(sendTimeout)) {
+            cout << spill->GetPendingCount() << " message(s) left in " << spill->GetFilePath()
+                << ", they will be sent on the next start" << endl;
+        }
+    }
+
+    static DWORD RemainingTime(ULONGLONG deadline) {
+        ULONGLONG now = GetTickCount64();
+        return now >= deadline ? 0 : static_cast<DWORD>(deadline - now);
     }
 
     void ShowStatus() {
-        WaitForSingleObject(hFileMutex, INFINITE);
         DWORD messageCount = ringBuffer->GetMessageCount();
         cout << "Queue status: " << messageCount << " messages in queue" << endl;
-        ReleaseMutex(hFileMutex);
+        cout << "Overflow policy: " << OverflowPolicyName(ringBuffer->GetOverflowPolicy())
+            << ", dropped: " << ringBuffer->GetDroppedCount()
+            << ", overwritten: " << ringBuffer->GetOverwrittenCount() << endl;
+        cout << "Topic: " << topic << endl;
+        if (spill) {
+            cout << "Spill: " << (spill->IsSpilling() ? "active" : "idle")
+                << ", spilled: " << spill->GetSpilledCount()
+                << ", replayed: " << spill->GetReplayedCount() << endl;
+        }
+
+        CreditUsage usage;
+        if (credited && ringBuffer->GetCreditUsage(senderId, usage)) {
+            cout << "Credits: " << usage.available << " available of window " << usage.window
+                << ", in flight: " << usage.inFlight << ", waited: " << usage.waits << " time(s)" << endl;
+        }
+        else {
+            cout << "Credits: not used" << endl;
+        }
+        cout << "Placement: sender " << DescribePlacement(core)
+            << ", queue memory node " << DescribeNumaNode(ringBuffer->GetNumaNode()) << endl;
     }
 
     void Cleanup() {
         SyncManager::SafeCloseHandle(hFileMutex);
         SyncManager::SafeCloseHandle(hMessageEvent);
-        SyncManager::SafeCloseHandle(hSpaceEvent);
-        SyncManager::SafeCloseHandle(hQueueSemaphore);
+        SyncManager::SafeCloseHandle(hCreditEvent);
         SyncManager::SafeCloseHandle(hReadyEvent);
     }
 };
 
 int main(int argc, char* argv[]) {
     if (argc < 3) {
-        cout << "Usage: sender.exe <filename> <sender_id>" << endl;
+        cout << "Usage: sender.exe <filename | segment@channel> <sender_id> [send_timeout_ms]"
+            << " [--core <n>] [--soak <first> <last>] [--coalesce <us>] [--perf]" << endl;
         return 1;
     }
 
     string fileName = argv[1];
     DWORD senderId;
+    DWORD sendTimeout = DEFAULT_SEND_TIMEOUT;
+    int core = NO_CORE;
+    bool soak = false;
+    ULONG64 soakFirst = 0, soakLast = 0;
+    DWORD coalesceUs = 0;
+    bool perf = false;
     try {
         senderId = stoi(argv[2]);
+        for (int i = 3; i < argc; i++) {
+            string option = argv[i];
+            if (option == "--soak" && i + 2 < argc) {
+                soak = true;
+                soakFirst = stoull(argv[++i]);
+                soakLast = stoull(argv[++i]);
+            }
+            else if (option == "--core" && i + 1 < argc) {
+                core = stoi(argv[++i]);
+            }
+            else if (option == "--coalesce" && i + 1 < argc) {
+                coalesceUs = stoul(argv[++i]);
+            }
+            else if (option == "--perf") {
+                perf = true;
+            }
+            else {
+                sendTimeout = stoul(option);
+            }
+        }
     }
     catch (const exception&) {
-        cout << "Invalid sender ID!" << endl;
+        cout << "Invalid sender arguments!" << endl;
         return 1;
     }
 
+    // Консольный Sender пишет по одному сообщению на команду: склеивать нечего,
+    // а буфер ждал бы сброса до следующей команды
+    if (!soak && (coalesceUs > 0 || perf)) {
+        cout << "--coalesce and --perf apply only to --soak" << endl;
+        return 1;
+    }
+
+    if (soak) {
+        try {
+            Sender sender(fileName, senderId, sendTimeout, core);
+            sender.RunSoak(soakFirst, soakLast, coalesceUs, perf);
+        }
+        catch (const exception& e) {
+            cout << "Error: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
     cout << "=== MESSAGE SENDER (ID: " << senderId << ") ===" << endl;
 
     try {
-        Sender sender(fileName, senderId);
+        Sender sender(fileName, senderId, sendTimeout, core);
         sender.SignalReady();
         sender.ProcessCommands();
 